@@ -0,0 +1,241 @@
+// Copyright (c) Meta Platforms, Inc. and affiliates.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+// Send buffer operations with 1k, 10k and 100k queued nodes: the Buffer
+// ring against the std::list Buffer it replaced
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <vector>
+
+#include "Buffer.h"
+
+using namespace rush;
+
+namespace {
+
+constexpr std::array<size_t, 3> kQueuedNodes = {1000, 10000, 100000};
+constexpr size_t kNodeSize = 1024;
+constexpr size_t kVecCount = 16;
+constexpr size_t kSteadyIterations = 1000000;
+constexpr size_t kDrainRounds = 10;
+
+using Clock = std::chrono::steady_clock;
+
+// the list Buffer the ring replaced, acked nodes are handed back to the
+// caller
+class ListBuffer {
+ public:
+  ListBuffer() {
+    witer_ = queue_.end();
+  }
+
+  int insert(Pool::Node&& node) {
+    queue_.emplace_back(std::move(node));
+    if (witer_ == queue_.end()) {
+      std::advance(witer_, -1);
+    }
+    return 0;
+  }
+
+  size_t getData(ngtcp2_vec* vec, size_t vcount) {
+    auto iter = witer_;
+    size_t vindex = 0;
+    if (offset_) {
+      vec[vindex].base = const_cast<uint8_t*>((*iter).data + offset_);
+      vec[vindex].len = (*iter).length - offset_;
+      ++vindex;
+      ++iter;
+    }
+    while (vindex < vcount && iter != queue_.end()) {
+      vec[vindex].base = const_cast<uint8_t*>((*iter).data);
+      vec[vindex].len = (*iter).length;
+      ++vindex;
+      ++iter;
+    }
+    return vindex;
+  }
+
+  int moveCursor(uint64_t bytes) {
+    while (bytes) {
+      const uint64_t remaining = (*witer_).length - offset_;
+      if (bytes < remaining) {
+        offset_ += bytes;
+        break;
+      }
+      bytes -= remaining;
+      ++witer_;
+      offset_ = 0;
+    }
+    return 0;
+  }
+
+  std::vector<Pool::Node> purge(uint64_t bytes) {
+    std::vector<Pool::Node> freeNodes;
+    while (bytes) {
+      const uint64_t remaining = queue_.front().length - ackoffset_;
+      if (bytes < remaining) {
+        ackoffset_ += bytes;
+        break;
+      }
+      bytes -= remaining;
+      freeNodes.emplace_back(std::move(queue_.front()));
+      queue_.pop_front();
+      ackoffset_ = 0;
+    }
+    return freeNodes;
+  }
+
+ private:
+  uint64_t offset_{0};
+  uint64_t ackoffset_{0};
+  std::list<Pool::Node>::const_iterator witer_;
+  std::list<Pool::Node> queue_;
+};
+
+// the operations a stream performs on its buffer, for both layouts
+struct RingOps {
+  Buffer buffer;
+  Pool& pool;
+  std::vector<Pool::Node> nodes;
+  FrameEntry frame;
+
+  void insert(Pool::Node&& node) {
+    nodes.emplace_back(std::move(node));
+    buffer.insert(nodes, frame);
+    nodes.clear();
+  }
+  size_t getData(ngtcp2_vec* vec, size_t vcount) {
+    return buffer.getData(vec, vcount);
+  }
+  void moveCursor(uint64_t bytes) {
+    buffer.moveCursor(bytes);
+  }
+  void purge(uint64_t bytes) {
+    buffer.purge(bytes, pool);
+    FrameEntry delivered;
+    while (buffer.popDelivered(delivered)) {
+    }
+  }
+};
+
+struct ListOps {
+  ListBuffer buffer;
+  Pool& pool;
+
+  void insert(Pool::Node&& node) {
+    buffer.insert(std::move(node));
+  }
+  size_t getData(ngtcp2_vec* vec, size_t vcount) {
+    return buffer.getData(vec, vcount);
+  }
+  void moveCursor(uint64_t bytes) {
+    buffer.moveCursor(bytes);
+  }
+  void purge(uint64_t bytes) {
+    for (auto& node : buffer.purge(bytes)) {
+      pool.free(std::move(node));
+    }
+  }
+};
+
+Pool::Node makeNode(Pool& pool) {
+  auto node = pool.get(kNodeSize);
+  node.length = kNodeSize;
+  return node;
+}
+
+// writes up to 'count' nodes the way QuicConnection does, one getData()
+// and moveCursor() per packet of vectors
+template <typename Ops>
+void write(Ops& ops, size_t count) {
+  std::array<ngtcp2_vec, kVecCount> vec{};
+  while (count) {
+    const size_t n = ops.getData(vec.data(), std::min(count, vec.size()));
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < n; ++i) {
+      bytes += vec[i].len;
+    }
+    ops.moveCursor(bytes);
+    count -= n;
+  }
+}
+
+// keeps 'queued' nodes in the buffer, half of them written, while one
+// node per iteration is inserted, written and acked
+template <typename Ops>
+double steady(Ops& ops, size_t queued) {
+  for (size_t i = 0; i < queued; ++i) {
+    ops.insert(makeNode(ops.pool));
+  }
+  write(ops, queued / 2);
+
+  std::array<ngtcp2_vec, 1> vec{};
+  const auto begin = Clock::now();
+  for (size_t i = 0; i < kSteadyIterations; ++i) {
+    ops.insert(makeNode(ops.pool));
+    ops.getData(vec.data(), vec.size());
+    ops.moveCursor(vec[0].len);
+    ops.purge(kNodeSize);
+  }
+  const auto elapsed =
+      std::chrono::duration<double, std::nano>(Clock::now() - begin);
+
+  write(ops, queued - queued / 2);
+  ops.purge(queued * kNodeSize);
+  return elapsed.count() / kSteadyIterations;
+}
+
+// queues 'queued' nodes, writes them all and acks them in one go
+template <typename Ops>
+double drain(Ops& ops, size_t queued) {
+  const auto begin = Clock::now();
+  for (size_t round = 0; round < kDrainRounds; ++round) {
+    for (size_t i = 0; i < queued; ++i) {
+      ops.insert(makeNode(ops.pool));
+    }
+    write(ops, queued);
+    ops.purge(queued * kNodeSize);
+  }
+  const auto elapsed =
+      std::chrono::duration<double, std::nano>(Clock::now() - begin);
+  return elapsed.count() / static_cast<double>(kDrainRounds * queued);
+}
+
+void print(const char* name, size_t queued, double steadyNs, double drainNs) {
+  std::printf("%-8s %8zu %16.1f %16.1f\n", name, queued, steadyNs, drainNs);
+}
+
+} // namespace
+
+int main() {
+  Pool pool;
+  std::printf(
+      "%-8s %8s %16s %16s\n",
+      "buffer",
+      "nodes",
+      "steady ns/node",
+      "drain ns/node");
+  for (const size_t queued : kQueuedNodes) {
+    {
+      RingOps ops{Buffer(), pool, {}, {}};
+      const double steadyNs = steady(ops, queued);
+      const double drainNs = drain(ops, queued);
+      print("ring", queued, steadyNs, drainNs);
+    }
+    {
+      ListOps ops{ListBuffer(), pool};
+      const double steadyNs = steady(ops, queued);
+      const double drainNs = drain(ops, queued);
+      print("list", queued, steadyNs, drainNs);
+    }
+  }
+  return 0;
+}
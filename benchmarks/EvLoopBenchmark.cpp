@@ -0,0 +1,223 @@
+// Copyright (c) Meta Platforms, Inc. and affiliates.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+// Cost of handing tasks to the loop thread from 1, 4 and 16 producers:
+// EvLoop::post() with recycled tasks, EvLoop::enqueue() with a
+// std::function, and the mutex-protected queue EvLoop used before
+
+#include <ev.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "Evloop.h"
+
+using namespace rush;
+
+namespace {
+
+constexpr size_t kTasksPerProducer = 100000;
+constexpr std::array<size_t, 3> kProducers = {1, 4, 16};
+
+using Clock = std::chrono::steady_clock;
+
+// the loop EvLoop replaced: every enqueue locks a std::queue of
+// std::function and wakes up the loop
+class LockedLoop {
+ public:
+  LockedLoop() : loop_(ev_loop_new(EVFLAG_AUTO)) {
+    ev_async_init(&asyncWatcher_, LockedLoop::asyncWatcherCallback);
+    asyncWatcher_.data = this;
+    ev_async_start(loop_, &asyncWatcher_);
+  }
+  ~LockedLoop() {
+    ev_loop_destroy(loop_);
+  }
+
+  void run() {
+    ev_run(loop_, 0);
+  }
+  void stop() {
+    ev_break(loop_, EVBREAK_ALL);
+  }
+  void enqueue(std::function<void()> f) {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      queue_.push(std::move(f));
+    }
+    ev_async_send(loop_, &asyncWatcher_);
+  }
+
+ private:
+  static void
+  asyncWatcherCallback(struct ev_loop* loop, ev_async* w, int revents) {
+    auto* self = static_cast<LockedLoop*>(w->data);
+    std::queue<std::function<void()>> functions;
+    {
+      std::lock_guard<std::mutex> guard(self->mutex_);
+      functions.swap(self->queue_);
+    }
+    while (!functions.empty()) {
+      functions.front()();
+      functions.pop();
+    }
+  }
+
+  struct ev_loop* loop_;
+  ev_async asyncWatcher_;
+  std::mutex mutex_;
+  std::queue<std::function<void()>> queue_;
+};
+
+struct CountTask final : EvLoop::Task {
+  void run() override {
+    count->fetch_add(1, std::memory_order_relaxed);
+  }
+  std::atomic<uint64_t>* count{nullptr};
+};
+
+struct StopTask final : EvLoop::Task {
+  void run() override {
+    loop->stop();
+  }
+  EvLoop* loop{nullptr};
+};
+
+struct Result {
+  // mean time a producer spent per enqueue
+  double enqueueNs{0};
+  // tasks run per second until the loop drained them all
+  double throughput{0};
+};
+
+// runs 'producers' threads calling 'enqueue(producer, index)' for every
+// task and waits until 'count' reached the total
+template <typename Enqueue>
+Result measure(
+    size_t producers,
+    std::atomic<uint64_t>& count,
+    const Enqueue& enqueue) {
+  const uint64_t total = producers * kTasksPerProducer;
+  std::vector<double> elapsed(producers);
+  std::vector<std::thread> threads;
+  std::atomic<bool> start{false};
+
+  for (size_t p = 0; p < producers; ++p) {
+    threads.emplace_back([&, p] {
+      while (!start.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      const auto begin = Clock::now();
+      for (size_t i = 0; i < kTasksPerProducer; ++i) {
+        enqueue(p, i);
+      }
+      elapsed[p] =
+          std::chrono::duration<double, std::nano>(Clock::now() - begin)
+              .count();
+    });
+  }
+
+  const auto begin = Clock::now();
+  start.store(true, std::memory_order_release);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  while (count.load(std::memory_order_relaxed) < total) {
+    std::this_thread::yield();
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+
+  Result result;
+  for (const double ns : elapsed) {
+    result.enqueueNs += ns / static_cast<double>(total);
+  }
+  result.throughput = static_cast<double>(total) / seconds;
+  return result;
+}
+
+Result measurePost(size_t producers) {
+  EvLoop loop;
+  std::atomic<uint64_t> count{0};
+  std::vector<CountTask> tasks(producers * kTasksPerProducer);
+  for (auto& task : tasks) {
+    task.count = &count;
+  }
+  std::thread consumer([&] { loop.run(0); });
+
+  const auto result = measure(producers, count, [&](size_t p, size_t i) {
+    loop.post(&tasks[p * kTasksPerProducer + i]);
+  });
+
+  StopTask stop;
+  stop.loop = &loop;
+  loop.post(&stop);
+  consumer.join();
+  return result;
+}
+
+Result measureEnqueue(size_t producers) {
+  EvLoop loop;
+  std::atomic<uint64_t> count{0};
+  std::thread consumer([&] { loop.run(0); });
+
+  const auto result = measure(producers, count, [&](size_t, size_t) {
+    loop.enqueue([&] { count.fetch_add(1, std::memory_order_relaxed); });
+  });
+
+  loop.enqueue([&] { loop.stop(); });
+  consumer.join();
+  return result;
+}
+
+Result measureLocked(size_t producers) {
+  LockedLoop loop;
+  std::atomic<uint64_t> count{0};
+  std::thread consumer([&] { loop.run(); });
+
+  const auto result = measure(producers, count, [&](size_t, size_t) {
+    loop.enqueue([&] { count.fetch_add(1, std::memory_order_relaxed); });
+  });
+
+  loop.enqueue([&] { loop.stop(); });
+  consumer.join();
+  return result;
+}
+
+void print(const char* name, size_t producers, const Result& result) {
+  std::printf(
+      "%-24s %9zu %14.1f %16.0f\n",
+      name,
+      producers,
+      result.enqueueNs,
+      result.throughput);
+}
+
+} // namespace
+
+int main() {
+  std::printf(
+      "%-24s %9s %14s %16s\n",
+      "queue",
+      "producers",
+      "ns/enqueue",
+      "tasks/s");
+  for (const size_t producers : kProducers) {
+    print("EvLoop::post", producers, measurePost(producers));
+    print("EvLoop::enqueue", producers, measureEnqueue(producers));
+    print("mutex + std::queue", producers, measureLocked(producers));
+  }
+  return 0;
+}
@@ -0,0 +1,317 @@
+// Copyright (c) Meta Platforms, Inc. and affiliates.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+// Streams synthetic H264 and AAC frames to a RUSH server in real time and
+// reports how long the server took to acknowledge them and the CPU time
+// of the client's loop thread. Run it once per transport setting under
+// the same network conditions to compare them, docker/benchmark-loss.sh
+// does so under netem packet loss and docker/benchmark-pacing.sh for timer
+// and SO_TXTIME pacing
+
+#include <getopt.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CodecUtils.h"
+#include "Constants.h"
+#include "Rush.h"
+
+namespace {
+
+constexpr uint32_t kFps = 30;
+constexpr uint32_t kGopFrames = 60;
+// a key frame is this many times larger than the other frames
+constexpr uint32_t kKeyFrameRatio = 5;
+constexpr uint32_t kVideoTimescale = 30000;
+constexpr uint32_t kAudioSampleRate = 48000;
+constexpr uint32_t kAudioFrameSamples = 1024;
+constexpr uint32_t kAudioKbps = 128;
+constexpr uint8_t kVideoTrack = 0;
+constexpr uint8_t kAudioTrack = 1;
+// time given to the server to acknowledge the last frames
+constexpr auto kDrainTimeout = std::chrono::seconds(10);
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  const char* host{nullptr};
+  int port{0};
+  int multiStream{0};
+  int pacingOffload{0};
+  uint32_t seconds{30};
+  uint32_t videoKbps{4000};
+  std::string path{"/benchmark"};
+};
+
+struct Delivery {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<uint32_t> videoDelays;
+  std::vector<uint32_t> keyDelays;
+  std::vector<uint32_t> audioDelays;
+  uint64_t delivered{0};
+};
+
+void onDelivered(
+    uint64_t sequenceId,
+    uint8_t trackId,
+    uint8_t flags,
+    uint32_t delayMs,
+    void* opaque) {
+  auto* delivery = static_cast<Delivery*>(opaque);
+  std::lock_guard<std::mutex> guard(delivery->mutex);
+  if (flags & RUSH_FRAME_VIDEO) {
+    delivery->videoDelays.push_back(delayMs);
+    if (flags & RUSH_FRAME_KEY) {
+      delivery->keyDelays.push_back(delayMs);
+    }
+  } else if (flags & RUSH_FRAME_AUDIO) {
+    delivery->audioDelays.push_back(delayMs);
+  } else {
+    // the Connect frame
+    return;
+  }
+  ++delivery->delivered;
+  delivery->cv.notify_all();
+}
+
+uint32_t percentile(std::vector<uint32_t>& delays, uint32_t p) {
+  if (delays.empty()) {
+    return 0;
+  }
+  const size_t index = (delays.size() - 1) * p / 100;
+  std::nth_element(delays.begin(), delays.begin() + index, delays.end());
+  return delays[index];
+}
+
+void printDelays(const char* name, std::vector<uint32_t>& delays) {
+  const uint32_t p50 = percentile(delays, 50);
+  const uint32_t p95 = percentile(delays, 95);
+  const uint32_t p99 = percentile(delays, 99);
+  const uint32_t max = percentile(delays, 100);
+  std::printf(
+      "%s_frames=%zu %s_p50_ms=%u %s_p95_ms=%u %s_p99_ms=%u %s_max_ms=%u\n",
+      name,
+      delays.size(),
+      name,
+      p50,
+      name,
+      p95,
+      name,
+      p99,
+      name,
+      max);
+}
+
+// CPU time of every thread but the calling one, which only produces the
+// frames, i.e. of the client's loop thread
+uint64_t loopCpuMicros() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  timespec self{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &self);
+  const int64_t process =
+      (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+      usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+  const int64_t caller = self.tv_sec * 1000000 + self.tv_nsec / 1000;
+  return static_cast<uint64_t>(std::max<int64_t>(0, process - caller));
+}
+
+void usage(const char* program) {
+  std::fprintf(
+      stderr,
+      "usage: %s [-m multi-stream mode] [-t] [-d seconds] [-b video kbps] "
+      "[-p path] host port\n"
+      "  -t  pace with SO_TXTIME instead of timers\n",
+      program);
+}
+
+int parseOptions(int argc, char** argv, Options& options) {
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "m:td:b:p:")) != -1) {
+    switch (opt) {
+      case 'm':
+        options.multiStream = std::atoi(optarg);
+        break;
+      case 't':
+        options.pacingOffload = 1;
+        break;
+      case 'd':
+        options.seconds = static_cast<uint32_t>(std::atoi(optarg));
+        break;
+      case 'b':
+        options.videoKbps = static_cast<uint32_t>(std::atoi(optarg));
+        break;
+      case 'p':
+        options.path = optarg;
+        break;
+      default:
+        return -1;
+    }
+  }
+  if (argc - optind != 2) {
+    return -1;
+  }
+  options.host = argv[optind];
+  options.port = std::atoi(argv[optind + 1]);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (parseOptions(argc, argv, options) != 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  RushTransportConfig config;
+  getDefaultTransportConfig(&config);
+  config.multiStream = options.multiStream;
+  config.pacingOffload = options.pacingOffload;
+  RushClientHandle client = createClientWithConfig(&config);
+  if (!client) {
+    std::fprintf(stderr, "invalid transport config\n");
+    return 1;
+  }
+
+  Delivery delivery;
+  setFrameDeliveredCallback(client, onDelivered, &delivery);
+  if (connectTo(client, options.host, options.port) < 0) {
+    std::fprintf(stderr, "connectTo failed\n");
+    destroyClient(client);
+    return 1;
+  }
+
+  RushMuxerHandle muxer = createMuxer();
+  addVideoStream(muxer, kVideoTimescale, kVideoTrack);
+  addAudioStream(muxer, kAudioSampleRate, kAudioTrack);
+
+  const std::string payload = "{\"url\" : \"" + options.path + "\"}";
+  std::vector<uint8_t> frame(getRushFrameSize(payload.size(), 0));
+  const ssize_t connectLength = connectFrame(
+      muxer,
+      reinterpret_cast<uint8_t*>(const_cast<char*>(payload.data())),
+      static_cast<int>(payload.size()),
+      frame.data(),
+      static_cast<int>(frame.size()));
+  if (connectLength < 0 ||
+      sendMessage(client, frame.data(), static_cast<int>(connectLength)) <
+          0) {
+    std::fprintf(stderr, "connect failed\n");
+    destroyMuxer(muxer);
+    destroyClient(client);
+    return 1;
+  }
+
+  // frame sizes keeping the average at the requested bitrates
+  const uint32_t gopBytes = options.videoKbps * 125 * kGopFrames / kFps;
+  const uint32_t frameBytes = gopBytes / (kGopFrames - 1 + kKeyFrameRatio);
+  const uint32_t audioBytes =
+      kAudioKbps * 125 * kAudioFrameSamples / kAudioSampleRate;
+  std::vector<uint8_t> data(frameBytes * kKeyFrameRatio);
+
+  const uint64_t videoFrames = uint64_t{options.seconds} * kFps;
+  const uint64_t audioFrames =
+      uint64_t{options.seconds} * kAudioSampleRate / kAudioFrameSamples;
+  uint64_t video = 0;
+  uint64_t audio = 0;
+  uint64_t sent = 0;
+  uint64_t refused = 0;
+
+  const auto begin = Clock::now();
+  const uint64_t cpuBegin = loopCpuMicros();
+  while (video < videoFrames || audio < audioFrames) {
+    // sends whichever frame is due first, at its capture time
+    const auto videoDue = std::chrono::microseconds(video * 1000000 / kFps);
+    const auto audioDue = std::chrono::microseconds(
+        audio * kAudioFrameSamples * 1000000 / kAudioSampleRate);
+    const bool sendVideo =
+        video < videoFrames && (audio >= audioFrames || videoDue <= audioDue);
+    std::this_thread::sleep_until(begin + (sendVideo ? videoDue : audioDue));
+
+    int ret = 0;
+    if (sendVideo) {
+      const bool key = video % kGopFrames == 0;
+      const uint64_t pts = video * kVideoTimescale / kFps;
+      ret = rushSendVideoFrame(
+          client,
+          muxer,
+          static_cast<uint8_t>(rush::VideoCodec::H264),
+          kVideoTrack,
+          key,
+          data.data(),
+          static_cast<int>(key ? frameBytes * kKeyFrameRatio : frameBytes),
+          pts,
+          pts,
+          nullptr,
+          0);
+      ++video;
+    } else {
+      ret = rushSendAudioFrame(
+          client,
+          muxer,
+          static_cast<uint8_t>(rush::AudioCodec::Aac),
+          kAudioTrack,
+          data.data(),
+          static_cast<int>(audioBytes),
+          audio * kAudioFrameSamples,
+          nullptr,
+          0);
+      ++audio;
+    }
+    if (ret < 0) {
+      ++refused;
+    } else {
+      ++sent;
+    }
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(delivery.mutex);
+    delivery.cv.wait_for(
+        lock, kDrainTimeout, [&] { return delivery.delivered >= sent; });
+  }
+  const uint64_t cpuMicros = loopCpuMicros() - cpuBegin;
+  const int64_t wallMicros =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          Clock::now() - begin)
+          .count();
+  rushClose(client);
+  destroyClient(client);
+  destroyMuxer(muxer);
+
+  std::lock_guard<std::mutex> guard(delivery.mutex);
+  std::printf(
+      "multi_stream=%d pacing=%s sent=%lu refused=%lu undelivered=%lu\n",
+      options.multiStream,
+      options.pacingOffload ? "txtime" : "timer",
+      static_cast<unsigned long>(sent),
+      static_cast<unsigned long>(refused),
+      static_cast<unsigned long>(
+          sent - std::min<uint64_t>(sent, delivery.delivered)));
+  printDelays("video", delivery.videoDelays);
+  printDelays("key", delivery.keyDelays);
+  printDelays("audio", delivery.audioDelays);
+  std::printf(
+      "loop_cpu_ms=%lu loop_cpu_pct=%.2f\n",
+      static_cast<unsigned long>(cpuMicros / 1000),
+      100.0 * static_cast<double>(cpuMicros) /
+          static_cast<double>(std::max<int64_t>(1, wallMicros)));
+  return 0;
+}
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Compares single-stream and multi-stream modes under packet loss.
+#
+# Runs send_benchmark against a RUSH server once per loss rate and mode,
+# with netem adding the loss and delay on the outgoing interface. Needs
+# root or NET_ADMIN, e.g. inside the container started by `make shell`.
+#
+# usage: benchmark-loss.sh host port [seconds]
+#
+# Environment:
+#   DEV        interface netem is attached to, eth0 by default
+#   DELAY_MS   one-way delay added with the loss, 20 by default
+#   LOSS       loss rates in percent, "1 2 3 4 5" by default
+#   MODES      multi-stream modes, "0 1 2" by default
+#   BENCHMARK  path of send_benchmark
+
+set -e
+
+if [ $# -lt 2 ]; then
+  sed -n '2,15p' "$0" | sed 's/^# \{0,1\}//'
+  exit 1
+fi
+
+HOST=$1
+PORT=$2
+SECONDS_PER_RUN=${3:-30}
+DEV=${DEV:-eth0}
+DELAY_MS=${DELAY_MS:-20}
+LOSS=${LOSS:-"1 2 3 4 5"}
+MODES=${MODES:-"0 1 2"}
+BENCHMARK=${BENCHMARK:-$HOME/rush/benchmarks/send_benchmark}
+
+cleanup() {
+  tc qdisc del dev "$DEV" root 2>/dev/null || true
+}
+trap cleanup EXIT
+
+for loss in $LOSS; do
+  tc qdisc replace dev "$DEV" root netem delay "${DELAY_MS}ms" loss "${loss}%"
+  for mode in $MODES; do
+    echo "loss=${loss}% delay=${DELAY_MS}ms"
+    "$BENCHMARK" -m "$mode" -d "$SECONDS_PER_RUN" "$HOST" "$PORT"
+  done
+done
@@ -0,0 +1,42 @@
+#!/bin/bash
+# Compares loop-thread CPU between timer and SO_TXTIME pacing.
+#
+# Runs send_benchmark against a RUSH server with user-space timer pacing
+# and with SO_TXTIME departure times at each bitrate. The fq qdisc, which
+# releases SO_TXTIME packets, is installed on the outgoing interface for
+# both runs so only the pacing mode differs. Needs root or NET_ADMIN,
+# e.g. inside the container started by `make shell`.
+#
+# usage: benchmark-pacing.sh host port [seconds]
+#
+# Environment:
+#   DEV        interface fq is attached to, eth0 by default
+#   BITRATES   video bitrates in kbps, "2000 8000 20000" by default
+#   BENCHMARK  path of send_benchmark
+
+set -e
+
+if [ $# -lt 2 ]; then
+  sed -n '2,15p' "$0" | sed 's/^# \{0,1\}//'
+  exit 1
+fi
+
+HOST=$1
+PORT=$2
+SECONDS_PER_RUN=${3:-30}
+DEV=${DEV:-eth0}
+BITRATES=${BITRATES:-"2000 8000 20000"}
+BENCHMARK=${BENCHMARK:-$HOME/rush/benchmarks/send_benchmark}
+
+cleanup() {
+  tc qdisc del dev "$DEV" root 2>/dev/null || true
+}
+trap cleanup EXIT
+
+tc qdisc replace dev "$DEV" root fq
+for kbps in $BITRATES; do
+  for pacing in "" "-t"; do
+    echo "video_kbps=${kbps}"
+    "$BENCHMARK" $pacing -b "$kbps" -d "$SECONDS_PER_RUN" "$HOST" "$PORT"
+  done
+done
@@ -11,36 +11,111 @@
 #include "Pool.h"
 
 #include <ngtcp2/ngtcp2.h>
-#include <list>
-#include <memory>
+#include <deque>
+#include <vector>
 
 namespace rush {
 
-using NodeList = std::list<Pool::Node>;
+// FrameEntry.flags
+constexpr uint8_t kFrameVideo = 0x1;
+constexpr uint8_t kFrameAudio = 0x2;
+constexpr uint8_t kFrameKey = 0x4;
 
+// index entry of one message queued in a Buffer. Messages are stored back
+// to back, a message's byte range starts at the previous entry's end.
+// Messages that are not a single media frame carry no flags
+struct FrameEntry {
+  uint64_t sequenceId{0};
+  // stream offset after the message's last byte
+  uint64_t end{0};
+  ngtcp2_tstamp enqueueTs{0};
+  uint32_t nodes{0};
+  uint8_t trackId{0};
+  uint8_t flags{0};
+};
+
+// ring of queued nodes. Nodes in [head_, write_) were handed to ngtcp2 and
+// wait for acknowledgement, nodes in [write_, tail_) are still to be
+// written. Indices grow monotonically and are masked into ring_, whose
+// size is a power of two and doubles when full
 class Buffer {
  public:
   Buffer();
   ~Buffer();
-  int insert(Pool::Node&& node);
+  // appends the nodes of one message and indexes it as 'frame'
+  int insert(std::vector<Pool::Node>& nodes, const FrameEntry& frame);
   size_t getData(ngtcp2_vec* vec, size_t vecCount);
   int moveCursor(
       uint64_t bytesWritten); // n bytes written to ngtcp2 buffer successfully
-  std::vector<Pool::Node> purge(
-      uint64_t bytesWritten); // n bytes acked from network successfully
+  // n bytes acked from network successfully. Completed nodes are returned
+  // to 'pool', caller-owned ones are released
+  void purge(uint64_t bytesAcked, Pool& pool);
+  // removes the oldest message from the index once it is fully acked
+  bool popDelivered(FrameEntry& frame);
   bool available();
+  // moves the write cursor back to the first unacknowledged byte
+  void rewind();
+  // empties the buffer for reuse on a new stream, returning all nodes to
+  // 'pool'. Messages still queued are not reported as delivered
+  void reset(Pool& pool);
+
+  uint64_t queuedBytes() const {
+    return appended_ - acked_;
+  }
+  uint64_t unsentBytes() const {
+    return appended_ - written_;
+  }
+  size_t queuedFrames() const {
+    return frames_.size();
+  }
+  // enqueue times of the oldest unacked and the oldest not fully written
+  // message, 0 when there is none
+  ngtcp2_tstamp oldestQueued() const;
+  ngtcp2_tstamp oldestUnsent() const;
+
+  // messages from index unstarted() on had no byte written yet and may
+  // still be dropped. dropUnstarted() removes those for which 'drop'
+  // returns true, returning their nodes to 'pool', and reports each
+  // removed message through 'dropped'
+  const std::deque<FrameEntry>& frames() const {
+    return frames_;
+  }
+  size_t unstarted() const;
+  void dropUnstarted(
+      Pool& pool,
+      bool (*drop)(const FrameEntry& frame, size_t index, void* context),
+      void (*dropped)(const FrameEntry& frame, uint64_t length, void* context),
+      void* context);
 
  private:
-  // position of write index relative to the buffer of element at witer
-  int64_t offset_{0};
+  Pool::Node& at(uint64_t index) {
+    return ring_[index & mask_];
+  }
+  void grow();
+
+  // position of write index relative to the buffer of element at write_
+  uint64_t offset_{0};
+
+  // position of ack index relative to the buffer of element at head_
+  uint64_t ackoffset_{0};
+
+  uint64_t head_{0};
+  uint64_t write_{0};
+  uint64_t tail_{0};
 
-  // position of ack index relative to the buffer of element at begin
-  int64_t ackoffset_{0};
+  std::vector<Pool::Node> ring_;
+  uint64_t mask_;
 
-  // write iterator, points to next element that needs to be written
-  NodeList::const_iterator witer_{};
+  // stream offsets of everything appended, written and acked
+  uint64_t appended_{0};
+  uint64_t written_{0};
+  uint64_t acked_{0};
 
-  NodeList queue_;
+  // unacked messages, the first 'unsent_' of them were fully written
+  std::deque<FrameEntry> frames_;
+  size_t unsent_{0};
+  // stream offset where the first message in frames_ starts
+  uint64_t frontStart_{0};
 };
 
 } // namespace rush
@@ -9,31 +9,55 @@
 #pragma once
 
 #include <ev.h>
+#include <atomic>
 #include <functional>
-#include <mutex>
-#include <queue>
+
+#include "MpscQueue.h"
 
 namespace rush {
 
 class EvLoop {
  public:
+  // intrusive unit of work, posting one does not allocate
+  struct Task : MpscNode {
+    virtual ~Task() = default;
+    // runs on the loop thread
+    virtual void run() = 0;
+    // replaces run() for tasks still queued when the loop is destroyed
+    virtual void cancel() {}
+  };
+
   EvLoop();
   ~EvLoop();
   void run(int flags);
+  // makes run() return, must be called from the loop thread
+  void stop();
+  // the caller keeps ownership of 'task' until run() or cancel()
+  void post(Task* task);
   void enqueue(std::function<void()> f);
   int enqueueAndWait(std::function<int()> f);
   struct ev_loop* get();
 
  private:
+  struct FunctionTask final : Task {
+    explicit FunctionTask(std::function<void()>&& f) : func(std::move(f)) {}
+    void run() override;
+    void cancel() override;
+    std::function<void()> func;
+  };
+
   static void
   asyncWatcherCallback(struct ev_loop* loop, ev_async* w, int revents);
-  static void process(std::queue<std::function<void()>>& funcs);
+  void process();
 
   struct ev_loop* loop_;
 
   ev_async asyncWatcher_;
-  std::queue<std::function<void()>> queue_;
-  std::mutex mutex_;
+  MpscQueue queue_;
+
+  // set by the producer that makes the queue non-empty, which is the only
+  // one that wakes up the loop. Cleared by the loop before draining
+  std::atomic<bool> pending_{false};
 };
 
 } // namespace rush
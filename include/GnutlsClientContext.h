@@ -12,23 +12,54 @@
 #include <gnutls/gnutls.h>
 #include <ngtcp2/ngtcp2_crypto.h>
 #include <fstream>
+#include <memory>
 
+#include "NonCopyable.h"
 #include "TLSClientContext.h"
 
 namespace rush {
 class QuicConnection;
 
+// certificate credentials and parsed priorities shared by all sessions
+struct GnutlsCredentials : private NonCopyable {
+  ~GnutlsCredentials();
+
+  gnutls_certificate_credentials_t certificates{nullptr};
+  gnutls_priority_t priority{nullptr};
+};
+
+class GNUTLSClientContext;
+
+// the session's user pointer. ngtcp2 reads it as its conn ref, the context
+// after it lets GnuTLS callbacks reach the GNUTLSClientContext
+struct GnutlsSessionRef {
+  ngtcp2_crypto_conn_ref connRef;
+  GNUTLSClientContext* context;
+};
+
 class GNUTLSClientContext : public TLSClientContext {
  public:
+  explicit GNUTLSClientContext(std::shared_ptr<GnutlsCredentials> credentials);
   ~GNUTLSClientContext();
+
+  // credentials shared by all connections of the process. Freed with the
+  // last connection holding them, nullptr on failure
+  static std::shared_ptr<GnutlsCredentials> getSharedCredentials();
+
   int init(const char* remoteHost, ngtcp2_crypto_conn_ref& ref) override;
   void* getNativeHandle() const override;
   int generateSecureRandom(uint8_t* data, size_t datalen) override;
   int setConnectionId(ngtcp2_cid* cid, uint8_t* token, size_t length) override;
+  void setSessionCallback(SessionCallback callback) override;
+  int resumeSession(const std::vector<uint8_t>& session, bool earlyData)
+      override;
+  void onNewSession(std::vector<uint8_t>&& session);
 
  private:
-  gnutls_certificate_credentials_t cred_;
-  gnutls_session_t session_;
+  const std::shared_ptr<GnutlsCredentials> credentials_;
+  gnutls_session_t session_{nullptr};
+  GnutlsSessionRef sessionRef_{};
+  SessionCallback sessionCallback_;
 };
 
 } // namespace rush
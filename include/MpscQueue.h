@@ -0,0 +1,75 @@
+// Copyright (c) Meta Platforms, Inc. and affiliates.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+#include <atomic>
+
+#include "NonCopyable.h"
+
+namespace rush {
+
+struct MpscNode {
+  std::atomic<MpscNode*> next{nullptr};
+};
+
+// Intrusive lock-free multi-producer single-consumer queue (Vyukov). push()
+// may be called from any thread, pop() only from the consumer thread
+class MpscQueue : private NonCopyable {
+ public:
+  MpscQueue() : head_(&stub_), tail_(&stub_) {}
+
+  void push(MpscNode* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    MpscNode* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // returns nullptr when the queue is empty, or when the next node is
+  // still being linked by a producer that will signal the consumer again
+  MpscNode* pop() {
+    MpscNode* tail = tail_;
+    MpscNode* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (!next) {
+        return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+      tail_ = next;
+      return tail;
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    // 'tail' is the last node, requeue the stub so it can be detached
+    push(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+      tail_ = next;
+      return tail;
+    }
+    return nullptr;
+  }
+
+  // consumer only. False as soon as a producer started a push, even while
+  // pop() cannot return the node yet
+  bool empty() const {
+    return tail_ == &stub_ && head_.load(std::memory_order_acquire) == &stub_;
+  }
+
+ private:
+  std::atomic<MpscNode*> head_;
+  MpscNode* tail_;
+  MpscNode stub_;
+};
+
+} // namespace rush
@@ -13,6 +13,7 @@
 #include <openssl/rand.h>
 #include <openssl/ssl.h>
 #include <fstream>
+#include <memory>
 
 #include "TLSClientContext.h"
 
@@ -23,14 +24,25 @@ class QuicConnection;
 
 class OpensslClientContext : public TLSClientContext {
  public:
+  explicit OpensslClientContext(std::shared_ptr<SSL_CTX> sslCtx);
   ~OpensslClientContext();
+
+  // SSL_CTX configured for QUIC shared by all connections of the process.
+  // Freed with the last connection holding it, nullptr on failure
+  static std::shared_ptr<SSL_CTX> getSharedContext();
+
   int init(const char* remoteHost, ngtcp2_crypto_conn_ref& ref) override;
   void* getNativeHandle() const override;
   int generateSecureRandom(uint8_t* data, size_t datalen) override;
   int setConnectionId(ngtcp2_cid* cid, uint8_t* token, size_t length) override;
+  void setSessionCallback(SessionCallback callback) override;
+  int resumeSession(const std::vector<uint8_t>& session, bool earlyData)
+      override;
+  void onNewSession(std::vector<uint8_t>&& session);
 
  private:
-  SSL_CTX* sslCtx_{nullptr};
+  const std::shared_ptr<SSL_CTX> sslCtx_;
   SSL* ssl_{nullptr};
+  SessionCallback sessionCallback_;
 };
 } // namespace rush
@@ -9,53 +9,111 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <vector>
 
-constexpr size_t kInitalPoolSize = 1000;
-constexpr size_t kNodeCapacity = 1024;
+#include "MpscQueue.h"
+
+// node sizes served by the pool. Each node of a message comes from the
+// largest class the rest of the message fills, so only the last node of a
+// message is partly empty, by less than the smallest class
+constexpr std::array<size_t, 4> kSizeClasses = {
+    1024,
+    16 * 1024,
+    64 * 1024,
+    256 * 1024};
+
+// contiguous region the nodes of one size class are carved from
+constexpr size_t kSlabSize = 2 * 1024 * 1024;
+
+// largest number of blocks a magazine caches
+constexpr size_t kMagazineSize = 64;
+
+struct PoolStats {
+  // get() calls served from a cached magazine
+  std::atomic<uint64_t> hits{0};
+  // get() calls that had to map a new slab
+  std::atomic<uint64_t> misses{0};
+  std::atomic<uint64_t> slabs{0};
+  // bytes handed out and not freed yet, and their maximum
+  std::atomic<uint64_t> inUse{0};
+  std::atomic<uint64_t> highWaterMark{0};
+};
 
 class Pool {
  public:
   struct Node {
-    Node(size_t capacity);
+    Node() = default;
     ~Node();
     size_t getCapacity() const;
 
-    Node(const Node& node);
+    // node referencing caller-owned memory instead of pool memory. Its
+    // release callback runs when the node is destroyed
+    static Node wrap(
+        uint8_t* data,
+        size_t length,
+        void (*release)(void* opaque),
+        void* opaque);
+    bool isExternal() const;
+
+    // nodes are move-only. Pool memory goes back through Pool::free() and
+    // stays owned by the pool's slabs otherwise
+    Node(Node&& other) noexcept;
+    Node& operator=(Node&& other) noexcept;
+    Node(const Node& node) = delete;
     Node& operator=(const Node& other) = delete;
 
     uint8_t* data{nullptr};
     size_t length{0};
 
    private:
-    size_t capacity_{0};
+    friend class Pool;
+    void reset();
 
-    // Node holds a pointer to an allocated memory and
-    // we do not want this struct to be copyable since
-    // that might lead to memory being accidentally freed
-    // during destruction of the copy.
-    //
-    // But, this struct gets passed to the event-loop thread
-    // as a part of std::function() and std::function()
-    // requires Node to be CopyConstructible.
-    //
-    // 'copied' makes sure that we do not free the memory when
-    // destroying copies of the struct.
-    mutable bool copied_{false};
+    size_t capacity_{0};
+    uint8_t sizeClass_{0};
+    void (*release_)(void* opaque){nullptr};
+    void* opaque_{nullptr};
   };
 
-  Pool();
+  // 'hugePages' backs slabs with huge pages when the system provides them
+  explicit Pool(bool hugePages = false);
   ~Pool();
-  Node get();
+
+  // get() and free() may run on different threads, but each on one thread
+  // only. Neither takes a lock unless a new magazine is allocated
+  Node get(size_t size);
   void free(Node&& node);
+  void printStats() const;
 
  private:
-  size_t nodeSize_{kNodeCapacity};
+  struct Magazine : rush::MpscNode {
+    size_t count{0};
+    std::array<uint8_t*, kMagazineSize> blocks;
+  };
+
+  // blocks move between the allocating and the freeing thread a magazine
+  // at a time, through the lock-free full and empty depots
+  struct SizeClass {
+    // owned by the thread calling get()
+    Magazine* allocating{nullptr};
+    // owned by the thread calling free()
+    Magazine* freeing{nullptr};
+    rush::MpscQueue full;
+    rush::MpscQueue empty;
+  };
+
+  // maps a slab for 'sizeClass' and returns one magazine of its blocks
+  Magazine* grow(size_t sizeClass);
+  Magazine* newMagazine();
 
-  void grow();
-  void reclaim();
-  std::vector<Node> pool_;
-  std::vector<Node> freed_;
-  std::mutex reclaimMutex_;
+  const bool hugePages_;
+  std::array<SizeClass, kSizeClasses.size()> classes_;
+  std::vector<void*> slabs_;
+  std::vector<std::unique_ptr<Magazine>> magazines_;
+  std::mutex magazinesMutex_;
+  PoolStats stats_;
 };
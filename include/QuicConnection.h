@@ -10,18 +10,77 @@
 
 #include <ngtcp2/ngtcp2.h>
 #include <ngtcp2/ngtcp2_crypto.h>
+#include <atomic>
 #include <fstream>
+#include <limits>
+#include <unordered_map>
 
 #include "Buffer.h"
 #include "ConnectionState.h"
 #include "NonCopyable.h"
 #include "QuicConnectionCallbacks.h"
+#include "Rush.h"
+#include "SessionCache.h"
 #include "Stream.h"
 #include "TLSClientContext.h"
 #include "Utils.h"
 
 namespace rush {
 
+struct TxStats {
+  uint64_t syscalls{0};
+  uint64_t packets{0};
+  uint64_t gsoBatches{0};
+  uint64_t mmsgBatches{0};
+  uint64_t blocked{0};
+  uint64_t bursts{0};
+  uint64_t pacingWaits{0};
+  uint64_t wakeups{0};
+};
+
+struct RxStats {
+  uint64_t syscalls{0};
+  uint64_t datagrams{0};
+  uint64_t batches{0};
+  uint64_t maxBatch{0};
+  uint64_t groSegments{0};
+};
+
+// written on the loop thread only, atomic so getEcnStats() may read them
+// from any thread
+struct EcnStats {
+  std::atomic<uint64_t> sentNotEct{0};
+  std::atomic<uint64_t> sentEct0{0};
+  std::atomic<uint64_t> sentEct1{0};
+  std::atomic<uint64_t> receivedNotEct{0};
+  std::atomic<uint64_t> receivedEct0{0};
+  std::atomic<uint64_t> receivedEct1{0};
+  std::atomic<uint64_t> receivedCe{0};
+  // one of RUSH_ECN_*
+  std::atomic<int> validation{RUSH_ECN_TESTING};
+};
+
+struct FlowControlStats {
+  // writes held back by the peer's stream or connection limit
+  uint64_t streamBlocked{0};
+  uint64_t connectionBlocked{0};
+  // receive window increases from auto-tuning
+  uint64_t windowUpdates{0};
+};
+
+struct PmtudStats {
+  uint64_t probesSent{0};
+  // probes larger than the local interface allows
+  uint64_t probesRejected{0};
+  // regular packets rejected with EMSGSIZE, each lowers payloadLimit_
+  uint64_t sizeReductions{0};
+};
+
+struct TxPacket {
+  iovec io;
+  uint8_t ecn;
+};
+
 class QuicConnection : private NonCopyable {
  public:
   QuicConnection(
@@ -30,14 +89,21 @@ class QuicConnection : private NonCopyable {
       Address localAddress,
       Address remoteAddress,
       QuicConnectionCallbacks callbacks,
-      std::shared_ptr<ConnectionSharedState> sharedConnectionState);
+      std::shared_ptr<ConnectionSharedState> sharedConnectionState,
+      const RushTransportConfig& config);
 
   ~QuicConnection();
 
   int connect();
   int disconnect();
   int onExtendMaxStreams();
+  int onExtendMaxStreamsUni();
+  int onStreamClosed(int64_t streamId);
+  // opens a unidirectional stream, NGTCP2_ERR_STREAM_ID_BLOCKED until the
+  // server grants more streams
+  int openUniStream(int64_t& streamId);
   int onHandshakeComplete();
+  int onEarlyDataRejected();
   int onExtendStreamMaxData(int64_t streamID);
   int recvStreamData(
       uint32_t flags,
@@ -55,22 +121,45 @@ class QuicConnection : private NonCopyable {
 
   int onRead();
   int onWrite();
+  void scheduleWrite();
   int handleExpiry();
   void printStats();
+  // safe from any thread
+  void getEcnStats(RushEcnStats& stats) const;
 
   ngtcp2_conn* getConnection();
   ngtcp2_connection_close_error* getLastError();
 
  private:
   void changeState(ConnectionState state);
+  int startEarlyData(const SessionCacheEntry& entry);
+  void onNewSession(std::vector<uint8_t>&& session);
   size_t getBuffer(
       int64_t& streamID,
       int& finish,
       ngtcp2_vec* dataVector,
       size_t dataVectorSize);
   int updateTimer();
+  uint64_t getWindowTarget();
+  void extendReceiveWindows(int64_t streamId, uint64_t consumed);
+  void schedulePacing(ngtcp2_tstamp ts);
+  ngtcp2_duration pacingInterval(size_t bytes);
+  uint64_t departureTime(size_t bytes);
   int handleError();
   NetworkError sendPacket(const uint8_t* data, size_t dataLength);
+  int readPacket(
+      const ngtcp2_path& path,
+      const uint8_t* data,
+      size_t dataLength,
+      uint8_t ecn,
+      ngtcp2_tstamp ts);
+  void countSentEcn(uint8_t ecn, uint64_t packets);
+  void trackEcnValidation(uint8_t ecn, ngtcp2_tstamp ts);
+  void onPacketTooBig(size_t dataLength);
+  void queuePacket(size_t dataLength, uint8_t ecn);
+  NetworkError flushPackets();
+  NetworkError sendGsoBatch();
+  NetworkError sendMmsgBatch();
 
   ngtcp2_conn* conn_{nullptr};
   ngtcp2_crypto_conn_ref connRef_{};
@@ -84,8 +173,62 @@ class QuicConnection : private NonCopyable {
   ev_io writeEv_;
   ev_timer timer_;
   ev_timer statsTimer_;
+  ev_timer pacingTimer_;
   const QuicConnectionCallbacks callbacks_;
   const std::shared_ptr<ConnectionSharedState> connstate_;
+  const RushTransportConfig config_;
+
+  // session cache key of the server, and whether the data stream is open.
+  // With 0-RTT the stream is opened before the handshake completes
+  std::string sessionKey_;
+  bool streamOpened_{false};
+  bool earlyDataSent_{false};
+
+  // receive windows currently granted to the peer, grown towards a
+  // multiple of the bandwidth-delay product up to config_.maxWindow
+  uint64_t connectionWindow_;
+  std::unordered_map<int64_t, uint64_t> streamWindows_;
+  FlowControlStats flowControlStats_;
+
+  // packets written by ngtcp2 are queued back to back in txBuffer_ and
+  // handed to the kernel together, either as a single UDP_SEGMENT (GSO)
+  // send of same-size packets or with sendmmsg. Packets from txSent_
+  // onwards have not been accepted by the kernel yet
+  std::vector<uint8_t> txBuffer_;
+  size_t txLength_{0};
+  std::vector<TxPacket> txPackets_;
+  size_t txSent_{0};
+  std::vector<mmsghdr> mmsgs_;
+  std::vector<uint8_t> txControl_;
+  bool gsoEnabled_{false};
+  TxStats txStats_;
+
+  // ngtcp2 probes for larger datagrams up to config_.maxUdpPayloadSize.
+  // A regular packet the kernel rejects as too big caps the size here
+  size_t payloadLimit_{std::numeric_limits<size_t>::max()};
+  PmtudStats pmtudStats_;
+
+  // with kernel pacing, the time the departures handed to the kernel run
+  // short and the departure time of the next datagram. Timer pacing
+  // follows ngtcp2_conn_get_pkt_tx_time() instead
+  ngtcp2_tstamp nextSendTs_{0};
+  bool txTimeEnabled_{false};
+  uint64_t txTime_{0};
+
+  // ring of receive buffers filled by a single recvmmsg. With UDP_GRO a
+  // buffer may hold several coalesced datagrams of the same size
+  std::vector<uint8_t> rxBuffer_;
+  std::vector<sockaddr_storage> rxAddresses_;
+  std::vector<uint8_t> rxControl_;
+  std::vector<iovec> rxIovecs_;
+  std::vector<mmsghdr> rxMmsgs_;
+  bool groEnabled_{false};
+  RxStats rxStats_;
+  EcnStats ecnStats_;
+  // consecutive packets ngtcp2 marked, and since when it has not marked
+  // any. 0 while the last packet was marked
+  size_t ecnMarkedRun_{0};
+  ngtcp2_tstamp ecnUnmarkedSince_{0};
 };
 
 } // namespace rush
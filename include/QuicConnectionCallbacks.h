@@ -46,6 +46,19 @@ typedef struct {
 
   int (*bindStream)(std::unique_ptr<Stream>&& stream, void* context);
 
+  // the server allows more unidirectional streams to be opened
+  int (*onExtendMaxStreamsUni)(void* context);
+
+  // ngtcp2 released a stream, all its data was acknowledged or it was reset
+  int (*onStreamClosed)(int64_t streamId, void* context);
+
+  // the server refused 0-RTT data, everything sent on the early stream must
+  // be written again once the handshake opens a new one
+  int (*onEarlyDataRejected)(void* context);
+
+  // the connection stopped and released its socket and watchers
+  void (*onConnectionClosed)(void* context);
+
   void* context;
 } QuicConnectionCallbacks;
 
@@ -10,11 +10,98 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// RUSH Transport configuration
+typedef enum {
+  RUSH_CC_RENO = 0,
+  RUSH_CC_CUBIC = 1,
+  RUSH_CC_BBR = 2,
+  RUSH_CC_BBR2 = 3,
+} RushCongestionControl;
+
+typedef struct {
+  RushCongestionControl congestionControl;
+
+  // flow-control windows advertised to the server, in bytes
+  uint64_t initialMaxData;
+  uint64_t initialMaxStreamData;
+
+  // upper bound for receive windows grown from the measured
+  // bandwidth-delay product, 0 keeps the initial windows
+  uint64_t maxWindow;
+
+  // largest UDP payload sent on the path
+  uint32_t maxUdpPayloadSize;
+
+  uint8_t ackDelayExponent;
+  uint32_t initialRttMs;
+
+  // 0 disables the idle timeout
+  uint32_t idleTimeoutMs;
+
+  // packets released back to back before waiting for the next pacing slot
+  uint32_t maxBurstPackets;
+
+  // pace with SO_TXTIME departure times released by the fq qdisc instead
+  // of user-space timers. Falls back to timers when the kernel does not
+  // support it
+  int pacingOffload;
+
+  // resume with a cached session ticket and send the Connect frame as 0-RTT
+  // data when the ticket allows it
+  int earlyData;
+
+  // file keeping session tickets across restarts, NULL keeps them in memory
+  // only. Read when the client is created
+  const char* sessionCacheFile;
+
+  // back send buffers with huge pages, reserved or transparent ones
+  int hugePages;
+
+  // budget for sent data not acknowledged yet, by size and by age of the
+  // oldest message. 0 disables a limit. Sends beyond the budget fail with
+  // RUSH_ERR_WOULD_BLOCK, after waiting up to sendTimeoutMs for room
+  uint64_t maxQueuedBytes;
+  uint32_t maxQueuedMs;
+  uint32_t sendTimeoutMs;
+
+  // once the oldest unsent message waited longer than this, queued video
+  // frames not written yet are dropped except key frames, beyond twice as
+  // long whole GOPs up to the newest key frame. A track that lost a frame
+  // then drops its later frames up to its next key frame, which may
+  // reference the lost one. 0 disables. Has no effect on media frames with
+  // RUSH_MULTI_STREAM_FRAME
+  uint32_t maxQueueDelayMs;
+
+  // RUSH multi-stream mode, media frames travel on unidirectional streams,
+  // one per frame or one per track, and only Connect and other control
+  // frames use the bidirectional stream. 0 sends everything on the latter
+  int multiStream;
+
+  // unidirectional streams the server may open towards the client. The
+  // client's own streams are limited by the server's transport parameters
+  uint32_t maxStreamsUni;
+} RushTransportConfig;
+
+// RushTransportConfig.multiStream
+#define RUSH_MULTI_STREAM_FRAME 1
+#define RUSH_MULTI_STREAM_TRACK 2
+
+// returned by the send functions when the send-buffer budget is exhausted
+#define RUSH_ERR_WOULD_BLOCK (-2)
+
+// returned by the first send, carrying the Connect frame, when the server
+// refused the broadcast or did not answer. The message was queued already
+#define RUSH_ERR_CONNECT_FAILED (-3)
+
+// fills 'config' with the values used by createClient()
+void getDefaultTransportConfig(RushTransportConfig* config);
+
 // RUSH Transport client
 struct RushClient;
 
@@ -22,10 +109,121 @@ typedef struct RushClient* RushClientHandle;
 
 RushClientHandle createClient(void);
 
+// returns NULL if 'config' is invalid
+RushClientHandle createClientWithConfig(const RushTransportConfig* config);
+
+// RUSH runtime, a fixed set of event loop threads shared by clients
+struct RushRuntime;
+
+typedef struct RushRuntime* RushRuntimeHandle;
+
+// 0 threads starts one loop thread per core
+RushRuntimeHandle createRuntime(int threads);
+
+// all clients bound to the runtime must be destroyed first
+void destroyRuntime(RushRuntimeHandle handle);
+
+// client running on one of the runtime's loop threads, NULL 'config' uses
+// the defaults. Returns NULL if 'config' is invalid
+RushClientHandle createClientWithRuntime(
+    RushRuntimeHandle runtime,
+    const RushTransportConfig* config);
+
 int connectTo(RushClientHandle handle, const char* host, int port);
 
+// each message should hold exactly one RUSH frame, as the muxer functions
+// produce. Only such messages are known as media frames, to which frame
+// delivery reports, late-frame dropping and the multi-stream modes apply.
+// Anything else, e.g. several frames or part of one, is sent as opaque data
+// on the bidirectional stream
 int sendMessage(RushClientHandle handle, const uint8_t* data, int size);
 
+// sends the concatenation of 'iov' as one message, e.g. a frame header and
+// its payload without joining them first
+int sendMessageV(RushClientHandle handle, const struct iovec* iov, int iovcnt);
+
+typedef void (*RushReleaseCallback)(void* opaque);
+
+// called from the client's loop thread once a send that returned
+// RUSH_ERR_WOULD_BLOCK can be retried, or the connection closed and the
+// retry fails. Set it before connectTo()
+typedef void (*RushWritableCallback)(void* opaque);
+
+void setWritableCallback(
+    RushClientHandle handle,
+    RushWritableCallback callback,
+    void* opaque);
+
+// flags of a delivered frame, messages that are not a single media frame
+// have none
+#define RUSH_FRAME_VIDEO 0x1
+#define RUSH_FRAME_AUDIO 0x2
+#define RUSH_FRAME_KEY 0x4
+
+// called from the client's loop thread for each message the server fully
+// acknowledged. Messages of one stream are reported in send order, with
+// RUSH_MULTI_STREAM_FRAME or RUSH_MULTI_STREAM_TRACK those of different
+// streams in the order their acknowledgements complete. 'delayMs' is the
+// time since it was queued. Set it before connectTo()
+typedef void (*RushFrameDeliveredCallback)(
+    uint64_t sequenceId,
+    uint8_t trackId,
+    uint8_t flags,
+    uint32_t delayMs,
+    void* opaque);
+
+void setFrameDeliveredCallback(
+    RushClientHandle handle,
+    RushFrameDeliveredCallback callback,
+    void* opaque);
+
+// milliseconds since the oldest message not acknowledged yet was queued
+uint32_t getQueuedMs(RushClientHandle handle);
+
+// RushEcnStats.validation, ngtcp2's verdict on whether the path carries ECN
+// markings intact. ngtcp2 does not report it, it is inferred from the
+// codepoints ngtcp2 gives outgoing packets: it marks a handful while
+// testing, all of them once validated and none after a failure
+#define RUSH_ECN_TESTING 0
+#define RUSH_ECN_CAPABLE 1
+#define RUSH_ECN_FAILED 2
+
+typedef struct {
+  // datagrams sent and received by ECN codepoint
+  uint64_t sentNotEct;
+  uint64_t sentEct0;
+  uint64_t sentEct1;
+  uint64_t receivedNotEct;
+  uint64_t receivedEct0;
+  uint64_t receivedEct1;
+  uint64_t receivedCe;
+  int validation;
+} RushEcnStats;
+
+// fills 'stats' for the client's connection, from any thread and also
+// after it closed. Returns -1 if connectTo() did not succeed
+int getEcnStats(RushClientHandle handle, RushEcnStats* stats);
+
+// with RUSH_MULTI_STREAM_TRACK, audio tracks are sent first and video tracks
+// share the rest in proportion to their weight, 1 by default. Set it
+// before connectTo()
+void setVideoTrackWeight(
+    RushClientHandle handle,
+    uint8_t trackId,
+    uint32_t weight);
+
+// sends 'data' without copying it. Once queued, the client owns the buffer
+// until it calls 'release' from its loop thread, after the server
+// acknowledged the whole message. Returns -1 or RUSH_ERR_WOULD_BLOCK without
+// taking ownership when 'size' is 0, the client is not connected or the
+// budget is exhausted. RUSH_ERR_CONNECT_FAILED is returned after taking it
+int sendMessageZeroCopy(
+    RushClientHandle handle,
+    const uint8_t* data,
+    size_t size,
+    RushReleaseCallback release,
+    void* opaque);
+
 void destroyClient(RushClientHandle handle);
 
 void rushClose(RushClientHandle handle);
@@ -95,6 +293,34 @@ ssize_t audioWithHeaderFrame(
 ssize_t
 endOfStreamFrame(RushMuxerHandle handle, uint8_t* buffer, int bufLength);
 
+// mux a frame straight into the client's send buffers, without a
+// caller-provided buffer. Return sendMessage() results. A frame refused
+// with RUSH_ERR_WOULD_BLOCK or -1 leaves the muxer unchanged, so retrying
+// it keeps sequence ids and key frame references intact
+int rushSendVideoFrame(
+    RushClientHandle client,
+    RushMuxerHandle muxer,
+    uint8_t codec,
+    uint8_t index,
+    int isKeyFrame,
+    uint8_t* data,
+    int length,
+    uint64_t pts,
+    uint64_t dts,
+    uint8_t* extradata,
+    int extradataLength);
+
+int rushSendAudioFrame(
+    RushClientHandle client,
+    RushMuxerHandle muxer,
+    uint8_t codec,
+    uint8_t index,
+    uint8_t* data,
+    int length,
+    uint64_t pts,
+    uint8_t* extradata,
+    int extradataLength);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,20 +8,49 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "Buffer.h"
 #include "ConnectionState.h"
 #include "Evloop.h"
+#include "MpscQueue.h"
 #include "Pool.h"
 #include "QuicConnection.h"
 #include "QuicConnectionCallbacks.h"
+#include "Rush.h"
+#include "RushRuntime.h"
+#include "Serializer.h"
 #include "Utils.h"
 
 class RushClient {
  public:
+  explicit RushClient(const RushTransportConfig& config);
+  // shares a loop thread of 'runtime', which must outlive the client
+  RushClient(const RushTransportConfig& config, RushRuntime* runtime);
+  ~RushClient();
   int connect(const char* hostname, int port);
   int sendMessage(const uint8_t* data, size_t length);
+  int sendMessageV(const iovec* io, size_t count);
+  // checks the connection and waits for budget for a frame of up to
+  // 'length' bytes. Muxing only after it succeeded keeps a refused send
+  // from consuming a sequence id
+  int reserveFrame(size_t length);
+  // serializes 'frame' directly into pool nodes, so the muxed frame never
+  // exists in an intermediate buffer. reserveFrame() must succeed first
+  int sendFrame(const rush::Serializable& frame);
+  // sends 'data' without copying it. 'release' runs on the loop thread once
+  // the server acknowledged every byte, or when the client is destroyed
+  int sendMessageZeroCopy(
+      const uint8_t* data,
+      size_t size,
+      void (*release)(void* opaque),
+      void* opaque);
   int close();
 
   size_t onSocketWriteable(
@@ -46,20 +75,153 @@ class RushClient {
 
   int bindStream(std::unique_ptr<rush::Stream>&& stream);
 
+  int onEarlyDataRejected();
+
+  void onConnectionClosed();
+
   int onStreamBlocked(int64_t streamId);
 
   int onExtendStreamMaxData(int64_t streamId);
 
+  int onExtendMaxStreamsUni();
+
+  int onStreamClosed(int64_t streamId);
+
+  // 'callback' runs on the loop thread once a send refused for exceeding
+  // the budget can be retried. Must be set before connect()
+  void setWritableCallback(void (*callback)(void* opaque), void* opaque);
+
+  // 'callback' runs on the loop thread for every message the server fully
+  // acknowledged, in send order per stream. Must be set before connect()
+  void setFrameDeliveredCallback(
+      RushFrameDeliveredCallback callback,
+      void* opaque);
+
+  // share of a video track in per-track mode. Must be set before connect()
+  void setVideoTrackWeight(uint8_t trackId, uint32_t weight);
+
+  // age of the oldest message not acknowledged yet
+  uint32_t getQueuedMs() const;
+
+  int getEcnStats(RushEcnStats& stats) const;
+
  private:
-  void writeToBuffer(Pool::Node&& node);
+  // hands the nodes of one message to the loop thread. Tasks return to
+  // freeTasks_ once run, so the steady state allocates none
+  struct WriteTask final : rush::EvLoop::Task {
+    explicit WriteTask(RushClient* client) : client(client) {}
+    void run() override;
+    RushClient* const client;
+    std::vector<Pool::Node> nodes;
+    size_t length{0};
+    rush::FrameEntry frame;
+  };
+
+  WriteTask* getWriteTask();
+  int queueMessage(WriteTask* task);
+  void writeToBuffer(WriteTask& task);
+
+  // send-buffer budget, see RushTransportConfig.maxQueuedBytes
+  bool withinBudget(size_t length) const;
+  int waitForBudget(size_t length);
+  void onFramesAcked(rush::Buffer& buffer, uint64_t length);
+  void updateOldestQueued();
+  void notifyWritable();
+
+  // drops late video that was not written yet, see
+  // RushTransportConfig.maxQueueDelayMs
+  void dropLateFrames(rush::Buffer& buffer);
+  // true when 'task' belongs to a track that lost a frame and waits for its
+  // next key frame. The message is then released instead of queued
+  bool skipFrame(WriteTask& task);
+  void onFrameDropped(const rush::FrameEntry& frame, uint64_t length);
   void changeState(rush::ConnectionState state);
 
+  // the control stream or a unidirectional one, nullptr once closed
+  rush::Stream* findStream(int64_t streamId);
+  std::unique_ptr<rush::Stream> newStream();
+  void openUniStreams();
+  // releases the frames of the first pending stream, which cannot be opened
+  void dropPendingStream();
+  // returns a closed or dropped stream's state to freeStreams_
+  void recycleStream(std::unique_ptr<rush::Stream> stream);
+  void removeTrackStream(rush::Stream* stream);
+  // the unidirectional stream to fill the next packet from, if any
+  rush::Stream* nextFrameStream();
+  rush::Stream* nextTrackStream();
+
   Pool pool_;
+
+  // every WriteTask allocated, those not in flight are linked in freeTasks_
+  std::vector<std::unique_ptr<WriteTask>> tasks_;
+  rush::MpscQueue freeTasks_;
+
+  // without a runtime the client runs its own loop on thread_
+  RushRuntime* const runtime_{nullptr};
   std::thread thread_;
   std::shared_ptr<rush::QuicConnection> conn_;
-  const std::shared_ptr<rush::EvLoop> loop_{std::make_shared<rush::EvLoop>()};
+  const std::shared_ptr<rush::EvLoop> loop_;
   const std::shared_ptr<rush::ConnectionSharedState> connstate_{
       std::make_shared<rush::ConnectionSharedState>()};
   std::unique_ptr<rush::Stream> stream_;
+
+  // multi-stream modes: a unidirectional stream waits in pendingStreams_
+  // for stream credit, lives in uniStreams_ until ngtcp2 closes it and is
+  // then recycled through freeStreams_. In per-frame mode writeOrder_
+  // holds the open streams with data left to write, oldest first
+  std::deque<std::unique_ptr<rush::Stream>> pendingStreams_;
+  std::map<int64_t, std::unique_ptr<rush::Stream>> uniStreams_;
+  std::vector<std::unique_ptr<rush::Stream>> freeStreams_;
+  std::deque<rush::Stream*> writeOrder_;
+
+  // per-track mode: one stream per track, keyed by track id with audio
+  // tracks marked. Audio streams are served strictly first, video streams
+  // by deficit round-robin starting at nextVideo_
+  struct VideoTrack {
+    rush::Stream* stream;
+    uint32_t weight;
+    int64_t deficit;
+  };
+  std::unordered_map<uint16_t, rush::Stream*> trackStreams_;
+  std::vector<rush::Stream*> audioStreams_;
+  std::vector<VideoTrack> videoTracks_;
+  size_t nextVideo_{0};
+  std::unordered_map<uint8_t, uint32_t> videoWeights_;
+
+  struct MultiStreamStats {
+    uint64_t opened{0};
+    uint64_t creditWaits{0};
+  } multiStreamStats_;
+
   bool connectSent_{false};
+  const RushTransportConfig config_;
+
+  // bytes handed to the loop and not acknowledged yet, and the enqueue
+  // time of the oldest such message (0 when none). The loop thread keeps
+  // the per-message index in each stream's txBuffer
+  std::atomic<uint64_t> queuedBytes_{0};
+  std::atomic<ngtcp2_tstamp> oldestQueuedTs_{0};
+
+  // set when a send was refused, the loop then signals budgetCv_ and the
+  // writable callback once the queue drained below the budget
+  std::atomic<bool> wouldBlock_{false};
+  std::mutex budgetMutex_;
+  std::condition_variable budgetCv_;
+  void (*writableCallback_)(void* opaque){nullptr};
+  void* writableOpaque_{nullptr};
+
+  RushFrameDeliveredCallback deliveredCallback_{nullptr};
+  void* deliveredOpaque_{nullptr};
+
+  struct DropStats {
+    uint64_t frames{0};
+    uint64_t bytes{0};
+  };
+  // loop thread only: drops per track, the video tracks whose frames are
+  // skipped up to their next key frame since a frame they reference was
+  // dropped, and the index of each track's newest droppable key frame
+  // during a drop pass
+  std::unordered_map<uint8_t, DropStats> dropStats_;
+  std::unordered_set<uint8_t> skipUntilKey_;
+  std::unordered_map<uint8_t, size_t> newestKeyFrames_;
 };
@@ -9,6 +9,7 @@
 #pragma once
 
 #include "Constants.h"
+#include "Frames.h"
 #include "Rush.h"
 #include "Utils.h"
 
@@ -27,6 +28,28 @@ class RushMuxer {
   ssize_t
   connectFrame(uint8_t* payload, int size, uint8_t* buffer, int bufferLength);
 
+  // frames referencing the caller's sample and extradata, to be serialized
+  // by the caller, e.g. straight into transport buffers
+  rush::VideoWithTrackFrame makeVideoWithTrackFrame(
+      rush::VideoCodec codec,
+      uint8_t index,
+      bool isKeyFrame,
+      uint8_t* data,
+      int length,
+      uint64_t pts,
+      uint64_t dts,
+      uint8_t* extradata,
+      int extradataLength);
+
+  rush::AudioWithTrackFrame makeAudioWithTrackFrame(
+      rush::AudioCodec codec,
+      uint8_t index,
+      uint8_t* data,
+      int length,
+      uint64_t pts,
+      uint8_t* extradata,
+      int extradataLength);
+
   ssize_t videoWithTrackFrame(
       rush::VideoCodec codec,
       uint8_t index,
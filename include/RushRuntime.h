@@ -0,0 +1,37 @@
+// Copyright (c) Meta Platforms, Inc. and affiliates.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Evloop.h"
+#include "NonCopyable.h"
+
+// Fixed set of event loop threads shared by many clients. Each client is
+// bound to the loop serving the fewest clients when it is created
+class RushRuntime : private rush::NonCopyable {
+ public:
+  // 0 threads starts one loop per core
+  explicit RushRuntime(size_t threads);
+  ~RushRuntime();
+
+  std::shared_ptr<rush::EvLoop> acquireLoop();
+  void releaseLoop(const std::shared_ptr<rush::EvLoop>& loop);
+
+ private:
+  std::vector<std::shared_ptr<rush::EvLoop>> loops_;
+  std::vector<std::thread> threads_;
+
+  // clients bound to each loop
+  std::vector<size_t> clients_;
+  std::mutex mutex_;
+};
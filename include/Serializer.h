@@ -43,9 +43,19 @@ size_t lengthParams(ByteStream stream, Rest... rest) {
   return stream.length + lengthParams(rest...);
 }
 
+// supplies more memory once a Cursor filled its current segment, so that a
+// frame can be written across non-contiguous buffers
+struct CursorSink {
+  // returns false when no more memory is available
+  virtual bool nextSegment(uint8_t*& data, size_t& length) = 0;
+  virtual ~CursorSink() = default;
+};
+
 class Cursor {
  public:
   Cursor(uint8_t* ptr, size_t size);
+  // writes into segments obtained from 'sink', reads are not supported
+  explicit Cursor(CursorSink* sink);
   bool canAdvance(size_t length);
   void advance(size_t length);
 
@@ -75,14 +85,23 @@ class Cursor {
     write(rest...);
   }
 
+  // total bytes written or read, across segments
   size_t position() const;
 
   bool available() const;
 
  private:
-  uint8_t* const start_{nullptr};
-  uint8_t* const end_{nullptr};
+  // writes spanning segment boundaries, throws std::out_of_range when
+  // memory runs out
+  void writeBytes(const uint8_t* data, size_t length);
+
+  uint8_t* start_{nullptr};
+  uint8_t* end_{nullptr};
   uint8_t* pos_{nullptr};
+  CursorSink* const sink_{nullptr};
+
+  // bytes written to previous segments
+  size_t base_{0};
 };
 
 struct Serializable {
@@ -0,0 +1,54 @@
+// Copyright (c) Meta Platforms, Inc. and affiliates.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+#include <ngtcp2/ngtcp2.h>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "NonCopyable.h"
+
+namespace rush {
+
+struct SessionCacheEntry {
+  // serialized TLS session, including the resumption ticket
+  std::vector<uint8_t> session;
+
+  // server transport parameters a client must remember to send 0-RTT data
+  // (RFC 9000 section 7.4.1)
+  ngtcp2_transport_params params;
+};
+
+// Process-wide cache of TLS sessions keyed by server address. Entries are
+// kept in memory and, once setFile() was called, mirrored to that file so
+// that they survive a restart of the process
+class SessionCache : private NonCopyable {
+ public:
+  static SessionCache& getInstance();
+
+  // loads the entries stored in 'path' and persists later updates there
+  void setFile(const std::string& path);
+
+  std::optional<SessionCacheEntry> find(const std::string& key);
+  void store(const std::string& key, SessionCacheEntry&& entry);
+
+ private:
+  SessionCache() = default;
+  void load();
+  void save();
+
+  std::mutex mutex_;
+  std::string path_;
+  std::unordered_map<std::string, SessionCacheEntry> entries_;
+};
+
+} // namespace rush
@@ -14,6 +14,10 @@ namespace rush {
 typedef struct {
   int64_t streamID{-1};
   bool blocked{false};
+  // the stream ends with FIN once everything in txBuffer was written
+  bool fin{false};
+  // in per-track mode, the track whose frames the stream carries
+  int32_t trackKey{-1};
   const std::unique_ptr<rush::Buffer> txBuffer{
       std::make_unique<rush::Buffer>()};
 } Stream;
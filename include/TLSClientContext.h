@@ -9,20 +9,35 @@
 #pragma once
 
 #include <ngtcp2/ngtcp2_crypto.h>
+#include <functional>
 #include <memory>
+#include <vector>
 
 namespace rush {
 
 class TLSClientContext {
  public:
+  // receives each session ticket issued by the server, serialized
+  using SessionCallback = std::function<void(std::vector<uint8_t>&& session)>;
+
   virtual int init(const char* address, ngtcp2_crypto_conn_ref& ref) = 0;
   virtual void* getNativeHandle() const = 0;
   virtual int generateSecureRandom(uint8_t* data, size_t datalen) = 0;
   virtual int
   setConnectionId(ngtcp2_cid* cid, uint8_t* token, size_t length) = 0;
+  virtual void setSessionCallback(SessionCallback callback) = 0;
+  // resumes a session reported by the session callback. Must be called
+  // after init(). Returns 1 when early data is enabled, which requires
+  // 'earlyData' and a ticket that allows it, 0 when resuming without early
+  // data and -1 if the session could not be used
+  virtual int resumeSession(
+      const std::vector<uint8_t>& session,
+      bool earlyData) = 0;
   virtual ~TLSClientContext() = default;
 };
 
+// per-connection TLS state on top of a process-wide configuration that is
+// created with the first connection and released with the last one
 std::unique_ptr<TLSClientContext> createTLSContext();
 
 } // namespace rush
@@ -0,0 +1,31 @@
+// Copyright (c) Meta Platforms, Inc. and affiliates.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#pragma once
+
+#include <ngtcp2/ngtcp2.h>
+
+#include "Rush.h"
+
+namespace rush {
+
+// largest number of packets released in one pacing burst
+constexpr uint32_t kMaxBurstPackets = 64;
+
+// RFC 9000 section 14: QUIC requires paths to carry 1200 byte datagrams
+constexpr uint32_t kMinUdpPayloadSize = 1200;
+
+RushTransportConfig getDefaultTransportConfig();
+
+// returns 0 if every field of 'config' is within the limits of ngtcp2 and
+// RFC 9000, otherwise logs the offending field and returns -1
+int validateTransportConfig(const RushTransportConfig& config);
+
+ngtcp2_cc_algo getCongestionControlAlgorithm(RushCongestionControl cc);
+
+} // namespace rush
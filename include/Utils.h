@@ -45,6 +45,22 @@ int createNonBlockingSocket(int domain, int type, int protocol);
 
 int createUdpSocket(int family);
 
+// returns true if the kernel accepts UDP_SEGMENT (GSO) on this socket
+bool isGsoSupported(int fd);
+
+// asks the kernel to coalesce received datagrams (UDP_GRO), returns true
+// on success
+bool enableGro(int fd);
+
+// enables SO_TXTIME so that datagrams can carry an SCM_TXTIME departure
+// time on the CLOCK_MONOTONIC clock used by timestamp(), returns true on
+// success
+bool enableTxTime(int fd);
+
+// returns the path MTU the kernel currently knows for the connected socket
+// 'fd', or 0 if it cannot be queried
+size_t getPathMtu(int fd, int family);
+
 ngtcp2_tstamp timestamp();
 
 void log_printf(void* user_data, const char* fmt, ...);
@@ -52,5 +68,6 @@ void log_printf(void* user_data, const char* fmt, ...);
 std::string logtimestamp();
 
 std::string getIPAddress(const Address& address);
+uint16_t getPort(const Address& address);
 
 } // namespace rush
@@ -10,76 +10,194 @@
 
 namespace rush {
 
-Buffer::Buffer() {
-  witer_ = queue_.end();
+static constexpr size_t kInitialCapacity = 64;
+
+// pool memory goes back to the pool, caller-owned memory is released
+static void releaseNode(Pool& pool, Pool::Node& node) {
+  if (node.isExternal()) {
+    Pool::Node released(std::move(node));
+  } else {
+    pool.free(std::move(node));
+  }
 }
 
+Buffer::Buffer() : ring_(kInitialCapacity), mask_(kInitialCapacity - 1) {}
+
 Buffer::~Buffer() {
-  queue_.clear();
+  ring_.clear();
 }
 
-int Buffer::insert(Pool::Node&& node) {
-  queue_.emplace_back(std::move(node));
-  if (witer_ == queue_.end()) {
-    std::advance(witer_, -1);
+void Buffer::grow() {
+  std::vector<Pool::Node> ring(ring_.size() * 2);
+  const uint64_t mask = ring.size() - 1;
+  for (uint64_t i = head_; i != tail_; ++i) {
+    ring[i & mask] = std::move(at(i));
   }
+  ring_.swap(ring);
+  mask_ = mask;
+}
+
+int Buffer::insert(std::vector<Pool::Node>& nodes, const FrameEntry& frame) {
+  for (auto& node : nodes) {
+    if (tail_ - head_ == ring_.size()) {
+      grow();
+    }
+    appended_ += node.length;
+    at(tail_++) = std::move(node);
+  }
+  frames_.push_back(frame);
+  frames_.back().end = appended_;
+  frames_.back().nodes = static_cast<uint32_t>(nodes.size());
   return 0;
 }
 
 size_t Buffer::getData(ngtcp2_vec* vec, size_t vcount) {
-  auto iter = witer_;
+  uint64_t index = write_;
   size_t vindex = 0;
   if (offset_) {
-    vec[vindex].base = const_cast<uint8_t*>((*iter).data + offset_);
-    vec[vindex].len = (*iter).length - offset_;
+    const auto& node = at(index);
+    vec[vindex].base = const_cast<uint8_t*>(node.data + offset_);
+    vec[vindex].len = node.length - offset_;
     ++vindex;
-    ++iter;
+    ++index;
   }
 
-  while (vindex < vcount && iter != queue_.end()) {
-    vec[vindex].base = const_cast<uint8_t*>((*iter).data);
-    vec[vindex].len = (*iter).length;
-    ++vindex;
-    ++iter;
+  for (; vindex < vcount && index != tail_; ++vindex, ++index) {
+    const auto& node = at(index);
+    vec[vindex].base = const_cast<uint8_t*>(node.data);
+    vec[vindex].len = node.length;
   }
   return vindex;
 }
 
 int Buffer::moveCursor(uint64_t bytes) {
-  uint64_t remaining = 0;
+  written_ += bytes;
+  while (unsent_ < frames_.size() && frames_[unsent_].end <= written_) {
+    ++unsent_;
+  }
   while (bytes) {
-    remaining = (*witer_).length - offset_;
+    const uint64_t remaining = at(write_).length - offset_;
     if (bytes < remaining) {
       offset_ += bytes;
       break;
     }
     bytes -= remaining;
-    ++witer_;
+    ++write_;
     offset_ = 0;
   }
   return 0;
 }
 
-std::vector<Pool::Node> Buffer::purge(uint64_t bytes) {
-  uint64_t remaining = 0;
-  std::vector<Pool::Node> freeNodes;
+void Buffer::purge(uint64_t bytes, Pool& pool) {
+  acked_ += bytes;
   while (bytes) {
-    auto iter = queue_.begin();
-    remaining = (*iter).length - ackoffset_;
+    auto& node = at(head_);
+    const uint64_t remaining = node.length - ackoffset_;
     if (bytes < remaining) {
       ackoffset_ += bytes;
       break;
     }
     bytes -= remaining;
-    freeNodes.emplace_back(std::move(queue_.front()));
-    queue_.pop_front();
+    releaseNode(pool, node);
+    ++head_;
     ackoffset_ = 0;
   }
-  return freeNodes;
+}
+
+bool Buffer::popDelivered(FrameEntry& frame) {
+  if (frames_.empty() || frames_.front().end > acked_) {
+    return false;
+  }
+  frame = frames_.front();
+  frames_.pop_front();
+  frontStart_ = frame.end;
+  if (unsent_) {
+    --unsent_;
+  }
+  return true;
+}
+
+ngtcp2_tstamp Buffer::oldestQueued() const {
+  return frames_.empty() ? 0 : frames_.front().enqueueTs;
+}
+
+ngtcp2_tstamp Buffer::oldestUnsent() const {
+  return unsent_ < frames_.size() ? frames_[unsent_].enqueueTs : 0;
+}
+
+void Buffer::reset(Pool& pool) {
+  for (; head_ != tail_; ++head_) {
+    releaseNode(pool, at(head_));
+  }
+  head_ = write_ = tail_ = 0;
+  offset_ = ackoffset_ = 0;
+  appended_ = written_ = acked_ = 0;
+  frames_.clear();
+  unsent_ = 0;
+  frontStart_ = 0;
+}
+
+size_t Buffer::unstarted() const {
+  size_t index = unsent_;
+  const uint64_t start = index ? frames_[index - 1].end : frontStart_;
+  if (index < frames_.size() && start < written_) {
+    ++index;
+  }
+  return index;
+}
+
+void Buffer::dropUnstarted(
+    Pool& pool,
+    bool (*drop)(const FrameEntry& frame, size_t index, void* context),
+    void (*dropped)(const FrameEntry& frame, uint64_t length, void* context),
+    void* context) {
+  const size_t first = unstarted();
+  uint64_t node = tail_;
+  for (size_t i = first; i < frames_.size(); ++i) {
+    node -= frames_[i].nodes;
+  }
+
+  // compacts the kept messages and their nodes towards the front
+  uint64_t start = first ? frames_[first - 1].end : frontStart_;
+  uint64_t removed = 0;
+  uint64_t nodeOut = node;
+  size_t frameOut = first;
+  for (size_t i = first; i < frames_.size(); ++i) {
+    FrameEntry frame = frames_[i];
+    const uint64_t length = frame.end - start;
+    start = frame.end;
+
+    if (drop(frame, i, context)) {
+      for (uint32_t k = 0; k < frame.nodes; ++k, ++node) {
+        releaseNode(pool, at(node));
+      }
+      removed += length;
+      dropped(frame, length, context);
+      continue;
+    }
+
+    for (uint32_t k = 0; k < frame.nodes; ++k, ++node, ++nodeOut) {
+      if (node != nodeOut) {
+        at(nodeOut) = std::move(at(node));
+      }
+    }
+    frame.end -= removed;
+    frames_[frameOut++] = frame;
+  }
+  tail_ = nodeOut;
+  frames_.resize(frameOut);
+  appended_ -= removed;
 }
 
 bool Buffer::available() {
-  return witer_ != queue_.end();
+  return write_ != tail_;
+}
+
+void Buffer::rewind() {
+  write_ = head_;
+  offset_ = ackoffset_;
+  written_ = acked_;
+  unsent_ = 0;
 }
 
 } // namespace rush
@@ -9,6 +9,7 @@
 #include "Evloop.h"
 
 #include <condition_variable>
+#include <mutex>
 
 namespace rush {
 
@@ -19,6 +20,10 @@ EvLoop::EvLoop() : loop_(ev_loop_new(EVFLAG_AUTO)) {
 }
 
 EvLoop::~EvLoop() {
+  // tasks never run are released without running them
+  while (auto* node = queue_.pop()) {
+    static_cast<Task*>(node)->cancel();
+  }
   if (loop_) {
     ev_loop_destroy(loop_);
   }
@@ -29,19 +34,15 @@ void EvLoop::asyncWatcherCallback(
     ev_async* w,
     int revents) {
   EvLoop* ev = static_cast<EvLoop*>(w->data);
-  std::queue<std::function<void()>> functions;
-  {
-    std::lock_guard<std::mutex> guard(ev->mutex_);
-    functions.swap(ev->queue_);
-  }
-  process(functions);
+  ev->process();
 }
 
-void EvLoop::process(std::queue<std::function<void()>>& functions) {
-  while (functions.size()) {
-    const auto& func = functions.front();
-    func();
-    functions.pop();
+void EvLoop::process() {
+  // cleared first, a task that pop() misses sets it again and sends
+  // another wakeup
+  pending_.store(false);
+  while (auto* node = queue_.pop()) {
+    static_cast<Task*>(node)->run();
   }
 }
 
@@ -49,16 +50,32 @@ void EvLoop::run(int flags) {
   ev_run(loop_, flags);
 }
 
+void EvLoop::stop() {
+  ev_break(loop_, EVBREAK_ALL);
+}
+
 struct ev_loop* EvLoop::get() {
   return loop_;
 }
 
-void EvLoop::enqueue(std::function<void()> f) {
-  {
-    std::lock_guard<std::mutex> guard(mutex_);
-    queue_.push(f);
+void EvLoop::FunctionTask::run() {
+  func();
+  delete this;
+}
+
+void EvLoop::FunctionTask::cancel() {
+  delete this;
+}
+
+void EvLoop::post(Task* task) {
+  queue_.push(task);
+  if (!pending_.exchange(true)) {
+    ev_async_send(loop_, &asyncWatcher_);
   }
-  ev_async_send(loop_, &asyncWatcher_);
+}
+
+void EvLoop::enqueue(std::function<void()> f) {
+  post(new FunctionTask(std::move(f)));
 }
 
 int EvLoop::enqueueAndWait(std::function<int()> f) {
@@ -10,6 +10,7 @@
 
 #include <ngtcp2/ngtcp2.h>
 #include <ngtcp2/ngtcp2_crypto_gnutls.h>
+#include <mutex>
 
 #include "QuicConnection.h"
 
@@ -45,7 +46,21 @@ static int hookFunction(
     unsigned when,
     unsigned int incoming,
     const gnutls_datum_t* msg) {
-  // no-op
+  if (htype != GNUTLS_HANDSHAKE_NEW_SESSION_TICKET || !incoming) {
+    return 0;
+  }
+  // the session's user pointer is the conn ref ngtcp2 expects, inside the
+  // GnutlsSessionRef that also carries the context
+  auto* ref = static_cast<GnutlsSessionRef*>(gnutls_session_get_ptr(session));
+  gnutls_datum_t data;
+  if (int error = gnutls_session_get_data2(session, &data)) {
+    std::cerr << "gnutls_session_get_data2 failed " << gnutls_strerror(error)
+              << std::endl;
+    return 0;
+  }
+  ref->context->onNewSession(
+      std::vector<uint8_t>(data.data, data.data + data.size));
+  gnutls_free(data.data);
   return 0;
 }
 
@@ -71,28 +86,95 @@ int GNUTLSClientContext::generateSecureRandom(uint8_t* data, size_t datalen) {
   return 0;
 }
 
+void GNUTLSClientContext::setSessionCallback(SessionCallback callback) {
+  sessionCallback_ = std::move(callback);
+}
+
+void GNUTLSClientContext::onNewSession(std::vector<uint8_t>&& session) {
+  if (sessionCallback_) {
+    sessionCallback_(std::move(session));
+  }
+}
+
+int GNUTLSClientContext::resumeSession(
+    const std::vector<uint8_t>& session,
+    bool earlyData) {
+  if (int error =
+          gnutls_session_set_data(session_, session.data(), session.size())) {
+    std::cerr << "Could not resume TLS session " << gnutls_strerror(error)
+              << std::endl;
+    return -1;
+  }
+  // GnuTLS restores the ticket's max_early_data_size with the session. A
+  // ticket without the early_data extension keeps the client default of
+  // UINT32_MAX, the value QUIC tickets carry, so the server's rejection of
+  // the early data covers that case
+  return earlyData && gnutls_record_get_max_early_data_size(session_) ? 1 : 0;
+}
+
 void* GNUTLSClientContext::getNativeHandle() const {
   return static_cast<void*>(session_);
 }
 
-int GNUTLSClientContext::init(
-    const char* remoteHost,
-    ngtcp2_crypto_conn_ref& ref) {
-  if (int error = gnutls_certificate_allocate_credentials(&cred_)) {
+GnutlsCredentials::~GnutlsCredentials() {
+  if (priority) {
+    gnutls_priority_deinit(priority);
+  }
+  if (certificates) {
+    gnutls_certificate_free_credentials(certificates);
+  }
+}
+
+std::shared_ptr<GnutlsCredentials> GNUTLSClientContext::getSharedCredentials() {
+  static std::mutex mutex;
+  static std::weak_ptr<GnutlsCredentials> shared;
+
+  std::lock_guard<std::mutex> guard(mutex);
+  if (auto credentials = shared.lock()) {
+    return credentials;
+  }
+
+  auto credentials = std::make_shared<GnutlsCredentials>();
+  if (int error =
+          gnutls_certificate_allocate_credentials(&credentials->certificates)) {
     std::cerr << "Cred init failed " << error << gnutls_strerror(error)
               << std::endl;
-    return -1;
+    return nullptr;
   }
 
-  if (int error = gnutls_certificate_set_x509_system_trust(cred_)) {
+  if (int error =
+          gnutls_certificate_set_x509_system_trust(credentials->certificates)) {
     if (error < 0) {
       // num certificates < 0 less than signals an error
       std::cerr << "Error setting gnutls certificate" << gnutls_strerror(error)
                 << " " << error << std::endl;
-      return -1;
+      return nullptr;
     }
   }
 
+  if (int error =
+          gnutls_priority_init(&credentials->priority, priority, nullptr)) {
+    std::cerr << "Error parsing GNU TLS priority " << gnutls_strerror(error)
+              << std::endl;
+    return nullptr;
+  }
+
+  shared = credentials;
+  return credentials;
+}
+
+GNUTLSClientContext::GNUTLSClientContext(
+    std::shared_ptr<GnutlsCredentials> credentials)
+    : credentials_(std::move(credentials)) {}
+
+int GNUTLSClientContext::init(
+    const char* remoteHost,
+    ngtcp2_crypto_conn_ref& ref) {
+  if (!credentials_) {
+    std::cerr << "No GNU TLS credentials" << std::endl;
+    return -1;
+  }
+
   if (int error = gnutls_init(
           &session_,
           GNUTLS_CLIENT | GNUTLS_ENABLE_EARLY_DATA |
@@ -107,19 +189,24 @@ int GNUTLSClientContext::init(
     return -1;
   }
 
-  if (int error = gnutls_priority_set_direct(session_, priority, nullptr)) {
+  if (int error = gnutls_priority_set(session_, credentials_->priority)) {
     std::cerr << "Error setting GNU TLS priority " << gnutls_strerror(error)
               << std::endl;
     return -1;
   }
 
   gnutls_handshake_set_hook_function(
-      session_, GNUTLS_HANDSHAKE_ANY, GNUTLS_HOOK_POST, hookFunction);
+      session_,
+      GNUTLS_HANDSHAKE_NEW_SESSION_TICKET,
+      GNUTLS_HOOK_POST,
+      hookFunction);
 
-  gnutls_session_set_ptr(session_, &ref);
+  sessionRef_.connRef = ref;
+  sessionRef_.context = this;
+  gnutls_session_set_ptr(session_, &sessionRef_.connRef);
 
-  if (int error =
-          gnutls_credentials_set(session_, GNUTLS_CRD_CERTIFICATE, cred_)) {
+  if (int error = gnutls_credentials_set(
+          session_, GNUTLS_CRD_CERTIFICATE, credentials_->certificates)) {
     std::cerr << "Error setting GNU TLS credentials " << gnutls_strerror(error)
               << std::endl;
     return -1;
@@ -146,8 +233,9 @@ int GNUTLSClientContext::init(
 }
 
 GNUTLSClientContext::~GNUTLSClientContext() {
-  gnutls_deinit(session_);
-  gnutls_certificate_free_credentials(cred_);
+  if (session_) {
+    gnutls_deinit(session_);
+  }
 }
 
 } // namespace rush
@@ -13,6 +13,7 @@
 #include <ngtcp2/ngtcp2.h>
 #include <ngtcp2/ngtcp2_crypto.h>
 #include <ngtcp2/ngtcp2_crypto_openssl.h>
+#include <mutex>
 
 constexpr unsigned char kRushAlpnV1[] = {6, 'r', 'u', 's', 'h', '/', '3'};
 constexpr unsigned int kAlpnLength = sizeof(kRushAlpnV1);
@@ -29,31 +30,80 @@ static int numeric_host(const char* hostname) {
       numeric_host_family(hostname, AF_INET6);
 }
 
+// ex data slot linking an SSL object to its OpensslClientContext
+static int contextIndex() {
+  static const int index =
+      SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+  return index;
+}
+
+static int newSessionCb(SSL* ssl, SSL_SESSION* session) {
+  auto* context = static_cast<OpensslClientContext*>(
+      SSL_get_ex_data(ssl, contextIndex()));
+  const int length = i2d_SSL_SESSION(session, nullptr);
+  if (!context || length <= 0) {
+    return 0;
+  }
+  std::vector<uint8_t> data(static_cast<size_t>(length));
+  auto* out = data.data();
+  i2d_SSL_SESSION(session, &out);
+  context->onNewSession(std::move(data));
+  // the session is kept serialized, OpenSSL may free it
+  return 0;
+}
+
 void* OpensslClientContext::getNativeHandle() const {
   return static_cast<void*>(ssl_);
 }
 
+OpensslClientContext::OpensslClientContext(std::shared_ptr<SSL_CTX> sslCtx)
+    : sslCtx_(std::move(sslCtx)) {}
+
 OpensslClientContext::~OpensslClientContext() {
   SSL_free(ssl_);
-  SSL_CTX_free(sslCtx_);
 }
 
-int OpensslClientContext::init(
-    const char* remoteHost,
-    ngtcp2_crypto_conn_ref& ref) {
-  sslCtx_ = SSL_CTX_new(TLS_client_method());
-  if (!sslCtx_) {
+std::shared_ptr<SSL_CTX> OpensslClientContext::getSharedContext() {
+  static std::mutex mutex;
+  static std::weak_ptr<SSL_CTX> shared;
+
+  std::lock_guard<std::mutex> guard(mutex);
+  if (auto sslCtx = shared.lock()) {
+    return sslCtx;
+  }
+
+  std::shared_ptr<SSL_CTX> sslCtx(
+      SSL_CTX_new(TLS_client_method()), SSL_CTX_free);
+  if (!sslCtx) {
     std::cerr << "SSL_CTX_new failed "
               << ERR_error_string(ERR_get_error(), nullptr) << std::endl;
-    return -1;
+    return nullptr;
   }
 
-  if (int error = ngtcp2_crypto_openssl_configure_client_context(sslCtx_)) {
+  if (int error =
+          ngtcp2_crypto_openssl_configure_client_context(sslCtx.get())) {
     std::cerr << "SSL configure failes with " << error;
+    return nullptr;
+  }
+
+  // new sessions are reported to the caller instead of an internal cache
+  SSL_CTX_set_session_cache_mode(
+      sslCtx.get(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(sslCtx.get(), newSessionCb);
+
+  shared = sslCtx;
+  return sslCtx;
+}
+
+int OpensslClientContext::init(
+    const char* remoteHost,
+    ngtcp2_crypto_conn_ref& ref) {
+  if (!sslCtx_) {
+    std::cerr << "No SSL context" << std::endl;
     return -1;
   }
 
-  ssl_ = SSL_new(sslCtx_);
+  ssl_ = SSL_new(sslCtx_.get());
   if (!ssl_) {
     std::cerr << "SSL_new failed" << ERR_error_string(ERR_get_error(), nullptr)
               << std::endl;
@@ -61,6 +111,7 @@ int OpensslClientContext::init(
   }
 
   SSL_set_app_data(ssl_, &ref);
+  SSL_set_ex_data(ssl_, contextIndex(), this);
   SSL_set_connect_state(ssl_);
   SSL_set_alpn_protos(
       ssl_, static_cast<const unsigned char*>(kRushAlpnV1), kAlpnLength);
@@ -72,6 +123,42 @@ int OpensslClientContext::init(
   return 0;
 }
 
+void OpensslClientContext::setSessionCallback(SessionCallback callback) {
+  sessionCallback_ = std::move(callback);
+}
+
+void OpensslClientContext::onNewSession(std::vector<uint8_t>&& session) {
+  if (sessionCallback_) {
+    sessionCallback_(std::move(session));
+  }
+}
+
+int OpensslClientContext::resumeSession(
+    const std::vector<uint8_t>& session,
+    bool earlyData) {
+  const uint8_t* data = session.data();
+  SSL_SESSION* resumed =
+      d2i_SSL_SESSION(nullptr, &data, static_cast<long>(session.size()));
+  if (!resumed) {
+    std::cerr << "Could not parse cached TLS session" << std::endl;
+    return -1;
+  }
+  const int error = SSL_set_session(ssl_, resumed);
+  // servers only allow 0-RTT on tickets carrying max_early_data
+  earlyData = earlyData && SSL_SESSION_get_max_early_data(resumed);
+  SSL_SESSION_free(resumed);
+  if (error != 1) {
+    std::cerr << "SSL_set_session failed "
+              << ERR_error_string(ERR_get_error(), nullptr) << std::endl;
+    return -1;
+  }
+  if (!earlyData) {
+    return 0;
+  }
+  SSL_set_quic_early_data_enabled(ssl_, 1);
+  return 1;
+}
+
 int OpensslClientContext::generateSecureRandom(uint8_t* data, size_t datalen) {
   if (RAND_bytes(data, static_cast<int>(datalen)) != 1) {
     return -1;
@@ -8,74 +8,215 @@
 
 #include "Pool.h"
 
-Pool::Node::Node(size_t max) : capacity_(max) {
-  data = static_cast<uint8_t*>(std::malloc(capacity_));
-  if (!data) {
-    throw std::bad_alloc();
-  }
-}
+#include <sys/mman.h>
+#include <iostream>
+#include <utility>
 
 Pool::Node::~Node() {
-  if (data && !copied_) {
-    std::free(data);
+  reset();
+}
+
+void Pool::Node::reset() {
+  if (release_) {
+    release_(opaque_);
   }
 }
 
+Pool::Node Pool::Node::wrap(
+    uint8_t* data,
+    size_t length,
+    void (*release)(void* opaque),
+    void* opaque) {
+  Node node;
+  node.data = data;
+  node.length = length;
+  node.capacity_ = length;
+  node.release_ = release;
+  node.opaque_ = opaque;
+  return node;
+}
+
+bool Pool::Node::isExternal() const {
+  return release_ != nullptr;
+}
+
 size_t Pool::Node::getCapacity() const {
   return capacity_;
 }
 
-Pool::Node::Node(const Pool::Node& node) {
-  capacity_ = node.getCapacity();
-  data = node.data;
-  length = node.length;
-
-  // Node holds a pointer to an allocated memory and
-  // we do not want this struct to be copyable since
-  // that might lead to memory being accidentally freed
-  // during destruction of the copy.
-  //
-  // But, this struct gets passed to the event-loop thread
-  // as a part of std::function() and std::function()
-  // requires Node to be CopyConstructible.
-  //
-  // 'copied' makes sure that we do not free the memory when
-  // destroying copies of the struct.
-  node.copied_ = true;
+Pool::Node::Node(Pool::Node&& other) noexcept
+    : data(std::exchange(other.data, nullptr)),
+      length(std::exchange(other.length, 0)),
+      capacity_(std::exchange(other.capacity_, 0)),
+      sizeClass_(other.sizeClass_),
+      release_(std::exchange(other.release_, nullptr)),
+      opaque_(std::exchange(other.opaque_, nullptr)) {}
+
+Pool::Node& Pool::Node::operator=(Pool::Node&& other) noexcept {
+  if (this != &other) {
+    reset();
+    data = std::exchange(other.data, nullptr);
+    length = std::exchange(other.length, 0);
+    capacity_ = std::exchange(other.capacity_, 0);
+    sizeClass_ = other.sizeClass_;
+    release_ = std::exchange(other.release_, nullptr);
+    opaque_ = std::exchange(other.opaque_, nullptr);
+  }
+  return *this;
+}
+
+namespace {
+
+// magazines of large classes hold fewer blocks, so that freed blocks do not
+// sit in a partially filled magazine while the allocating side grows
+constexpr size_t magazineCapacity(size_t sizeClass) {
+  return std::clamp<size_t>(
+      kSlabSize / kSizeClasses[sizeClass] / 8, 1, kMagazineSize);
 }
 
-Pool::Pool() {
-  grow();
+} // namespace
+
+Pool::Pool(bool hugePages) : hugePages_(hugePages) {
+  classes_[0].allocating = grow(0);
 }
 
 Pool::~Pool() {
-  pool_.clear();
+  for (auto* slab : slabs_) {
+    munmap(slab, kSlabSize);
+  }
 }
 
-void Pool::grow() {
-  std::generate_n(std::back_inserter(pool_), kInitalPoolSize, [&]() {
-    return Node(nodeSize_);
-  });
+Pool::Magazine* Pool::newMagazine() {
+  std::lock_guard<std::mutex> lock(magazinesMutex_);
+  magazines_.push_back(std::make_unique<Magazine>());
+  return magazines_.back().get();
 }
 
-void Pool::reclaim() {
-  std::lock_guard<std::mutex> lock(reclaimMutex_);
-  pool_.swap(freed_);
+Pool::Magazine* Pool::grow(size_t sizeClass) {
+  void* slab = MAP_FAILED;
+  if (hugePages_) {
+    slab = mmap(
+        nullptr,
+        kSlabSize,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+        -1,
+        0);
+  }
+  if (slab == MAP_FAILED) {
+    slab = mmap(
+        nullptr,
+        kSlabSize,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+    if (slab == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    if (hugePages_) {
+      // no reserved huge pages, ask for transparent ones instead
+      madvise(slab, kSlabSize, MADV_HUGEPAGE);
+    }
+  }
+  slabs_.push_back(slab);
+  ++stats_.slabs;
+
+  // the caller gets the first magazine of new blocks directly, the rest
+  // enter the full depot
+  auto& full = classes_[sizeClass].full;
+  const size_t capacity = magazineCapacity(sizeClass);
+  auto* base = static_cast<uint8_t*>(slab);
+  Magazine* first{nullptr};
+  const auto filled = [&](Magazine* magazine) {
+    if (first) {
+      full.push(magazine);
+    } else {
+      first = magazine;
+    }
+  };
+  Magazine* magazine{nullptr};
+  for (size_t offset = 0; offset < kSlabSize;
+       offset += kSizeClasses[sizeClass]) {
+    if (!magazine) {
+      magazine = newMagazine();
+    }
+    magazine->blocks[magazine->count++] = base + offset;
+    if (magazine->count == capacity) {
+      filled(magazine);
+      magazine = nullptr;
+    }
+  }
+  if (magazine) {
+    filled(magazine);
+  }
+  return first;
 }
 
 void Pool::free(Node&& node) {
-  std::lock_guard<std::mutex> lock(reclaimMutex_);
-  freed_.emplace_back(std::move(node));
+  if (node.isExternal() || !node.data) {
+    return;
+  }
+  auto& sizeClass = classes_[node.sizeClass_];
+  if (!sizeClass.freeing ||
+      sizeClass.freeing->count == magazineCapacity(node.sizeClass_)) {
+    if (sizeClass.freeing) {
+      sizeClass.full.push(sizeClass.freeing);
+    }
+    auto* empty = sizeClass.empty.pop();
+    sizeClass.freeing =
+        empty ? static_cast<Magazine*>(empty) : newMagazine();
+  }
+  sizeClass.freeing->blocks[sizeClass.freeing->count++] =
+      std::exchange(node.data, nullptr);
+  stats_.inUse.fetch_sub(node.capacity_, std::memory_order_relaxed);
 }
 
-Pool::Node Pool::get() {
-  if (!pool_.size()) {
-    reclaim();
+Pool::Node Pool::get(size_t size) {
+  size_t index = 0;
+  while (index + 1 < kSizeClasses.size() && kSizeClasses[index + 1] <= size) {
+    ++index;
   }
-  if (!pool_.size()) {
-    grow();
+  auto& sizeClass = classes_[index];
+  if (!sizeClass.allocating || !sizeClass.allocating->count) {
+    // pop() also returns nullptr while free() is still linking a magazine,
+    // only a depot that is really empty needs a new slab
+    Magazine* full{nullptr};
+    do {
+      full = static_cast<Magazine*>(sizeClass.full.pop());
+    } while (!full && !sizeClass.full.empty());
+    if (full) {
+      stats_.hits.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      stats_.misses.fetch_add(1, std::memory_order_relaxed);
+      full = grow(index);
+    }
+    if (sizeClass.allocating) {
+      sizeClass.empty.push(sizeClass.allocating);
+    }
+    sizeClass.allocating = full;
+  } else {
+    stats_.hits.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  auto* magazine = sizeClass.allocating;
+  Node node;
+  node.data = magazine->blocks[--magazine->count];
+  node.capacity_ = kSizeClasses[index];
+  node.sizeClass_ = static_cast<uint8_t>(index);
+
+  const uint64_t inUse =
+      stats_.inUse.fetch_add(node.capacity_, std::memory_order_relaxed) +
+      node.capacity_;
+  if (inUse > stats_.highWaterMark.load(std::memory_order_relaxed)) {
+    stats_.highWaterMark.store(inUse, std::memory_order_relaxed);
   }
-  auto node = std::move(pool_.back());
-  pool_.pop_back();
   return node;
 }
+
+void Pool::printStats() const {
+  std::cout << "Pool hits [" << stats_.hits << "] misses [" << stats_.misses
+            << "] slabs [" << stats_.slabs << "] in use ["
+            << stats_.inUse / 1024 << " KiB] high-water mark ["
+            << stats_.highWaterMark / 1024 << " KiB]" << std::endl;
+}
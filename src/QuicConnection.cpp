@@ -8,7 +8,10 @@
 
 #include "QuicConnection.h"
 #include "RushClient.h"
+#include "TransportConfig.h"
 
+#include <netinet/udp.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <algorithm>
 #include <cassert>
@@ -19,7 +22,38 @@
 #include <random>
 
 static constexpr float kPrintStatsSeconds = 60.;
-static constexpr uint32_t kSendBatchSize = 10;
+// 1.25 is the under-utilization avoidance factor of RFC 9002 section 7.7,
+// used when the congestion controller does not provide a pacing rate
+static constexpr double kPacingGain = 1.25;
+
+// receive windows are grown to this multiple of the bandwidth-delay
+// product so that credit never limits a sender running at full rate
+static constexpr uint64_t kWindowBdpMultiplier = 2;
+
+// Linux caps a single GSO send at 64 segments and at most 64 KiB of payload.
+// The same limit is used for the number of messages in a sendmmsg batch
+static constexpr size_t kMaxBatchPackets = 64;
+static_assert(rush::kMaxBurstPackets <= kMaxBatchPackets);
+static constexpr size_t kTxBufferSize = 65507;
+
+// datagrams read per recvmmsg call. Each buffer is large enough for a
+// UDP_GRO super-packet
+static constexpr size_t kRxBatchSize = 8;
+static constexpr size_t kRxBufferSize = 65536;
+static constexpr size_t kRxControlSize = 64;
+static constexpr size_t kEcnControlSize = CMSG_SPACE(sizeof(int));
+static constexpr size_t kTxTimeControlSize = CMSG_SPACE(sizeof(uint64_t));
+static constexpr size_t kTxControlSize = kEcnControlSize + kTxTimeControlSize;
+
+// with kernel pacing, a write stops once departures reach this far ahead so
+// that fq neither drops packets beyond its horizon nor queues stale data
+static constexpr ngtcp2_duration kTxTimeHorizon = 5 * NGTCP2_MILLISECONDS;
+
+// ngtcp2 marks at most this many packets while it tests a path for ECN
+// (NGTCP2_ECN_MAX_NUM_VALIDATION_PKTS), a longer run means it validated.
+// No marks for this many PTOs mean the validation failed
+static constexpr size_t kEcnTestingPackets = 10;
+static constexpr uint64_t kEcnFailedPtos = 3;
 
 namespace {
 
@@ -34,6 +68,31 @@ static int extendMaxLocalBidirectionalStreamsCb(
   return 0;
 }
 
+static int extendMaxLocalUnidirectionalStreamsCb(
+    ngtcp2_conn* conn,
+    uint64_t maxStreams,
+    void* userData) {
+  auto* client = static_cast<rush::QuicConnection*>(userData);
+  if (client->onExtendMaxStreamsUni()) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+  return 0;
+}
+
+static int streamCloseCb(
+    ngtcp2_conn* conn,
+    uint32_t flags,
+    int64_t streamID,
+    uint64_t appErrorCode,
+    void* userData,
+    void* streamUserData) {
+  auto* client = static_cast<rush::QuicConnection*>(userData);
+  if (client->onStreamClosed(streamID)) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+  return 0;
+}
+
 static void
 randomCb(uint8_t* dest, size_t destlen, const ngtcp2_rand_ctx* ctx) {
   (void)ctx;
@@ -63,6 +122,14 @@ static int onHandshakeComplete(ngtcp2_conn* conn, void* userData) {
   return 0;
 }
 
+static int earlyDataRejectedCb(ngtcp2_conn* conn, void* userData) {
+  auto* client = static_cast<rush::QuicConnection*>(userData);
+  if (client->onEarlyDataRejected()) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+  return 0;
+}
+
 static int extendMaxStreamDataCb(
     ngtcp2_conn* conn,
     int64_t streamID,
@@ -107,6 +174,52 @@ static int ackStreamDataCb(
   return 0;
 }
 
+// appends a control message to 'msg', whose msg_control buffer must have
+// room for it, and returns a pointer to its payload
+static uint8_t* appendCmsg(msghdr& msg, int level, int type, size_t length) {
+  auto* cmsg = reinterpret_cast<cmsghdr*>(
+      static_cast<uint8_t*>(msg.msg_control) + msg.msg_controllen);
+  cmsg->cmsg_level = level;
+  cmsg->cmsg_type = type;
+  cmsg->cmsg_len = CMSG_LEN(length);
+  msg.msg_controllen += CMSG_SPACE(length);
+  return CMSG_DATA(cmsg);
+}
+
+// marks an outgoing datagram with 'ecn' using IP_TOS / IPV6_TCLASS
+static void appendEcnCmsg(msghdr& msg, int family, uint8_t ecn) {
+  const int tos = ecn;
+  auto* data = family == AF_INET6
+      ? appendCmsg(msg, IPPROTO_IPV6, IPV6_TCLASS, sizeof(tos))
+      : appendCmsg(msg, IPPROTO_IP, IP_TOS, sizeof(tos));
+  std::memcpy(data, &tos, sizeof(tos));
+}
+
+// sets the earliest departure time of an outgoing datagram
+static void appendTxTimeCmsg(msghdr& msg, uint64_t txTime) {
+#ifdef SO_TXTIME
+  auto* data = appendCmsg(msg, SOL_SOCKET, SCM_TXTIME, sizeof(txTime));
+  std::memcpy(data, &txTime, sizeof(txTime));
+#endif
+}
+
+// extracts the ECN codepoint from an IP_TOS / IPV6_TCLASS control message
+static uint8_t getEcn(msghdr& msg) {
+  for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TOS &&
+        cmsg->cmsg_len) {
+      return *CMSG_DATA(cmsg) & NGTCP2_ECN_MASK;
+    }
+    if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_TCLASS &&
+        cmsg->cmsg_len) {
+      int tclass{0};
+      std::memcpy(&tclass, CMSG_DATA(cmsg), sizeof(tclass));
+      return static_cast<uint8_t>(tclass & NGTCP2_ECN_MASK);
+    }
+  }
+  return NGTCP2_ECN_NOT_ECT;
+}
+
 static ngtcp2_conn* getConnectionCb(ngtcp2_crypto_conn_ref* ref) {
   auto* client = static_cast<rush::QuicConnection*>(ref->user_data);
   return client->getConnection();
@@ -125,6 +238,8 @@ static void readCallback(struct ev_loop* loop, ev_io* w, int revents) {
 
 static void writeCallback(struct ev_loop* loop, ev_io* w, int revents) {
   auto client = static_cast<rush::QuicConnection*>(w->data);
+  // the write watcher is only armed while the socket is blocked
+  ev_io_stop(loop, w);
   if (client->onWrite()) {
     return;
   }
@@ -138,6 +253,11 @@ static void timeoutCallback(struct ev_loop* loop, ev_timer* w, int revents) {
   client->onWrite();
 }
 
+static void pacingCallback(struct ev_loop* loop, ev_timer* w, int revents) {
+  auto client = static_cast<rush::QuicConnection*>(w->data);
+  client->onWrite();
+}
+
 static void statsCallback(struct ev_loop* loop, ev_timer* w, int revents) {
   auto client = static_cast<rush::QuicConnection*>(w->data);
   client->printStats();
@@ -153,24 +273,47 @@ QuicConnection::QuicConnection(
     Address localAddress,
     Address remoteAddress,
     QuicConnectionCallbacks callbacks,
-    std::shared_ptr<ConnectionSharedState> sharedConnectionState)
+    std::shared_ptr<ConnectionSharedState> sharedConnectionState,
+    const RushTransportConfig& config)
     : loop_(loop),
       fd_(fd),
       localAddress_(localAddress),
       remoteAddress_(remoteAddress),
       tls_(createTLSContext()),
       callbacks_(callbacks),
-      connstate_(sharedConnectionState) {}
+      connstate_(sharedConnectionState),
+      config_(config),
+      connectionWindow_(config.initialMaxData),
+      txBuffer_(kTxBufferSize),
+      mmsgs_(kMaxBatchPackets),
+      txControl_(kMaxBatchPackets * kTxControlSize),
+      rxBuffer_(kRxBatchSize * kRxBufferSize),
+      rxAddresses_(kRxBatchSize),
+      rxControl_(kRxBatchSize * kRxControlSize),
+      rxIovecs_(kRxBatchSize),
+      rxMmsgs_(kRxBatchSize) {
+  txPackets_.reserve(kMaxBatchPackets);
+}
 
 int QuicConnection::connect() {
   connRef_.get_conn = ::getConnectionCb;
   connRef_.user_data = this;
 
+  sessionKey_ = getIPAddress(remoteAddress_) + ":" +
+      std::to_string(getPort(remoteAddress_));
+  tls_->setSessionCallback([this](std::vector<uint8_t>&& session) {
+    onNewSession(std::move(session));
+  });
+
   if (tls_->init(getIPAddress(remoteAddress_).c_str(), connRef_)) {
     std::cerr << "TLS init error" << std::endl;
     return -1;
   }
 
+  const auto cachedSession = SessionCache::getInstance().find(sessionKey_);
+  const bool earlyData = cachedSession &&
+      tls_->resumeSession(cachedSession->session, config_.earlyData) == 1;
+
   ngtcp2_callbacks callbacks = {
       ngtcp2_crypto_client_initial_cb,
       nullptr, /* recv_client_initial */
@@ -183,11 +326,11 @@ int QuicConnection::connect() {
       ::recvStreamDataCb, /* recv_stream_data */
       ::ackStreamDataCb, /* acked_stream_data_offset */
       nullptr, /* stream_open */
-      nullptr, /* stream_close */
+      ::streamCloseCb, /* stream_close */
       nullptr, /* recv_stateless_reset */
       ngtcp2_crypto_recv_retry_cb,
       ::extendMaxLocalBidirectionalStreamsCb,
-      nullptr, /* extend_max_local_streams_uni */
+      ::extendMaxLocalUnidirectionalStreamsCb,
       randomCb,
       getNewConnectionIdCb,
       nullptr, /* remove_connection_id */
@@ -211,24 +354,27 @@ int QuicConnection::connect() {
       ngtcp2_crypto_version_negotiation_cb,
       nullptr, /* receive rx key*/
       nullptr, /* receive tx key*/
-      nullptr, /* early data rejected*/
+      ::earlyDataRejectedCb, /* early data rejected*/
   };
 
   // settings
   ngtcp2_settings settings;
   ngtcp2_settings_default(&settings);
   settings.initial_ts = timestamp();
-  settings.cc_algo = NGTCP2_CC_ALGO_BBR;
+  settings.cc_algo = getCongestionControlAlgorithm(config_.congestionControl);
+  settings.initial_rtt = config_.initialRttMs * NGTCP2_MILLISECONDS;
+  settings.max_tx_udp_payload_size = config_.maxUdpPayloadSize;
 
   // transport params
   ngtcp2_transport_params params;
   ngtcp2_transport_params_default(&params);
-  params.initial_max_streams_uni = 3;
+  params.initial_max_streams_uni = config_.maxStreamsUni;
   params.initial_max_streams_bidi = 3;
-  params.initial_max_stream_data_bidi_local = 1024 * 1024;
-  params.initial_max_stream_data_bidi_remote = 1024 * 1024;
-  params.initial_max_data = 1024 * 1024;
-  params.max_idle_timeout = 300 * NGTCP2_SECONDS;
+  params.initial_max_stream_data_bidi_local = config_.initialMaxStreamData;
+  params.initial_max_stream_data_bidi_remote = config_.initialMaxStreamData;
+  params.initial_max_data = config_.initialMaxData;
+  params.max_idle_timeout = config_.idleTimeoutMs * NGTCP2_MILLISECONDS;
+  params.ack_delay_exponent = config_.ackDelayExponent;
 
   ngtcp2_cid scid, dcid;
   scid.datalen = 8;
@@ -273,22 +419,43 @@ int QuicConnection::connect() {
 
   ngtcp2_conn_set_tls_native_handle(conn_, tls_->getNativeHandle());
 
+  if (earlyData && startEarlyData(*cachedSession)) {
+    std::cerr << "Could not start 0-RTT, waiting for the handshake"
+              << std::endl;
+  }
+
+  gsoEnabled_ = isGsoSupported(fd_);
+  groEnabled_ = enableGro(fd_);
+
+  if (config_.pacingOffload) {
+    txTimeEnabled_ = enableTxTime(fd_);
+    if (!txTimeEnabled_) {
+      std::cerr << "SO_TXTIME unavailable [" << strerror(errno)
+                << "], pacing with timers" << std::endl;
+    }
+  }
+
   ev_io_init(&readEv_, ::readCallback, fd_, EV_READ);
   readEv_.data = this;
   ev_io_start(loop_, &readEv_);
 
   ev_io_init(&writeEv_, ::writeCallback, fd_, EV_WRITE);
   writeEv_.data = this;
-  ev_io_start(loop_, &writeEv_);
 
   ev_timer_init(&timer_, ::timeoutCallback, 0., 0.);
   timer_.data = this;
 
+  ev_timer_init(&pacingTimer_, ::pacingCallback, 0., 0.);
+  pacingTimer_.data = this;
+
   ev_timer_init(&statsTimer_, ::statsCallback, kPrintStatsSeconds, 0.);
   statsTimer_.data = this;
   statsTimer_.repeat = kPrintStatsSeconds;
   ev_timer_again(loop_, &statsTimer_);
 
+  // send the initial packet
+  scheduleWrite();
+
   return 0;
 }
 
@@ -307,20 +474,88 @@ void QuicConnection::changeState(ConnectionState state) {
   connstate_->stateCv.notify_all();
 }
 
+int QuicConnection::startEarlyData(const SessionCacheEntry& entry) {
+  if (int error =
+          ngtcp2_conn_set_early_remote_transport_params(conn_, &entry.params)) {
+    std::cerr << "Invalid cached transport parameters "
+              << ngtcp2_strerror(error) << std::endl;
+    return -1;
+  }
+  if (int error = onExtendMaxStreams()) {
+    std::cerr << "Could not open 0-RTT stream " << ngtcp2_strerror(error)
+              << std::endl;
+    return -1;
+  }
+  earlyDataSent_ = true;
+
+  // the Connect frame leaves with the first flight as 0-RTT data
+  changeState(ConnectionState::TransportConnected);
+  return 0;
+}
+
+void QuicConnection::onNewSession(std::vector<uint8_t>&& session) {
+  SessionCacheEntry entry;
+  entry.session = std::move(session);
+  ngtcp2_conn_get_remote_transport_params(conn_, &entry.params);
+  SessionCache::getInstance().store(sessionKey_, std::move(entry));
+}
+
 int QuicConnection::onExtendMaxStreams() {
+  // the stream opened for 0-RTT data survives the handshake, and later
+  // MAX_STREAMS frames must not replace it
+  if (streamOpened_) {
+    return 0;
+  }
   auto stream = std::make_unique<rush::Stream>();
   if (int error =
           ngtcp2_conn_open_bidi_stream(conn_, &stream->streamID, nullptr)) {
     return error;
   }
+  streamOpened_ = true;
   if (callbacks_.bindStream) {
     callbacks_.bindStream(std::move(stream), callbacks_.context);
   }
   return 0;
 }
 
+int QuicConnection::onExtendMaxStreamsUni() {
+  if (callbacks_.onExtendMaxStreamsUni) {
+    return callbacks_.onExtendMaxStreamsUni(callbacks_.context);
+  }
+  return 0;
+}
+
+int QuicConnection::onStreamClosed(int64_t streamId) {
+  streamWindows_.erase(streamId);
+  if (callbacks_.onStreamClosed) {
+    return callbacks_.onStreamClosed(streamId, callbacks_.context);
+  }
+  return 0;
+}
+
+int QuicConnection::openUniStream(int64_t& streamId) {
+  return ngtcp2_conn_open_uni_stream(conn_, &streamId, nullptr);
+}
+
 int QuicConnection::onHandshakeComplete() {
-  changeState(ConnectionState::TransportConnected);
+  // with 0-RTT the connection was reported usable before the handshake
+  if (connstate_->state.load(std::memory_order_relaxed) ==
+      ConnectionState::Unset) {
+    changeState(ConnectionState::TransportConnected);
+  }
+  return 0;
+}
+
+int QuicConnection::onEarlyDataRejected() {
+  std::cerr << "Server rejected 0-RTT data, resending after handshake"
+            << std::endl;
+  // ngtcp2 closed the early stream, a new one is opened once the server's
+  // stream limits are known
+  streamOpened_ = false;
+  earlyDataSent_ = false;
+  if (callbacks_.onEarlyDataRejected) {
+    return callbacks_.onEarlyDataRejected(callbacks_.context);
+  }
   return 0;
 }
 
@@ -358,12 +593,49 @@ int QuicConnection::recvStreamData(
     }
   }
   if (processed) {
-    ngtcp2_conn_extend_max_stream_offset(conn_, streamId, datalen);
-    ngtcp2_conn_extend_max_offset(conn_, datalen);
+    extendReceiveWindows(streamId, datalen);
   }
   return 0;
 }
 
+uint64_t QuicConnection::getWindowTarget() {
+  if (!config_.maxWindow) {
+    return 0;
+  }
+  ngtcp2_conn_stat stat;
+  ngtcp2_conn_get_conn_stat(conn_, &stat);
+  // rtt in microseconds keeps the product within 64 bits
+  const uint64_t rttMicros = stat.smoothed_rtt / NGTCP2_MICROSECONDS;
+  const uint64_t bdp = stat.delivery_rate_sec * rttMicros / 1000000;
+  return std::min(kWindowBdpMultiplier * bdp, config_.maxWindow);
+}
+
+void QuicConnection::extendReceiveWindows(int64_t streamId, uint64_t consumed) {
+  // consumed data is always credited back. On top of that, a window smaller
+  // than the current target is grown by the difference
+  const uint64_t target = getWindowTarget();
+
+  auto& streamWindow =
+      streamWindows_.try_emplace(streamId, config_.initialMaxStreamData)
+          .first->second;
+  uint64_t streamCredit = consumed;
+  if (target > streamWindow) {
+    streamCredit += target - streamWindow;
+    streamWindow = target;
+    ++flowControlStats_.windowUpdates;
+  }
+
+  uint64_t connectionCredit = consumed;
+  if (target > connectionWindow_) {
+    connectionCredit += target - connectionWindow_;
+    connectionWindow_ = target;
+    ++flowControlStats_.windowUpdates;
+  }
+
+  ngtcp2_conn_extend_max_stream_offset(conn_, streamId, streamCredit);
+  ngtcp2_conn_extend_max_offset(conn_, connectionCredit);
+}
+
 int QuicConnection::ackStreamData(
     ngtcp2_conn* conn,
     int64_t streamId,
@@ -399,22 +671,107 @@ ngtcp2_connection_close_error* QuicConnection::getLastError() {
   return &lastError_;
 }
 
+void QuicConnection::scheduleWrite() {
+  // a running pacing timer calls onWrite() at the next send slot anyway.
+  // Feeding the event coalesces any number of requests per loop iteration
+  if (!ev_is_active(&pacingTimer_)) {
+    ev_feed_event(loop_, &pacingTimer_, EV_TIMER);
+  }
+}
+
+void QuicConnection::schedulePacing(ngtcp2_tstamp ts) {
+  if (txTimeEnabled_) {
+    // packets already carry their departure times. Wake up again only once
+    // the schedule handed to the kernel gets close to running out
+    nextSendTs_ = txTime_ > ts + kTxTimeHorizon ? txTime_ - kTxTimeHorizon
+                                                : ts;
+    return;
+  }
+  // ngtcp2 holds ack-eliciting packets back until the slot that follows
+  // from the bytes written since the last update
+  ngtcp2_conn_update_pkt_tx_time(conn_, ts);
+}
+
+ngtcp2_duration QuicConnection::pacingInterval(size_t bytes) {
+  ngtcp2_conn_stat stat;
+  ngtcp2_conn_get_conn_stat(conn_, &stat);
+
+  // pacing rate is expressed in bytes per nanosecond
+  double pacingRate = stat.pacing_rate;
+  if (pacingRate <= 0 && stat.smoothed_rtt) {
+    pacingRate = kPacingGain * static_cast<double>(stat.cwnd) /
+        static_cast<double>(stat.smoothed_rtt);
+  }
+  if (pacingRate <= 0) {
+    return 0;
+  }
+  const double interval = static_cast<double>(bytes) / pacingRate;
+  return static_cast<ngtcp2_duration>(interval);
+}
+
+uint64_t QuicConnection::departureTime(size_t bytes) {
+  txTime_ = std::max<uint64_t>(txTime_, timestamp());
+  const uint64_t departure = txTime_;
+  txTime_ += pacingInterval(bytes);
+  return departure;
+}
+
 int QuicConnection::onWrite() {
+  // packets left over from a blocked send go out before anything new
+  if (flushPackets() == NetworkError::sendBlocked) {
+    return 0;
+  }
+
   const ngtcp2_tstamp ts = timestamp();
-  const size_t payloadSize = ngtcp2_conn_get_max_tx_udp_payload_size(conn_);
+
+  // Packet Pacing: Quic recommends against sending traffic in bursts.
+  // Bursts of at most config_.maxBurstPackets are released at the rate computed
+  // by the congestion controller, the pacing timer fires at the next slot.
+  // Until then only packets ngtcp2 does not pace are written, ACKs,
+  // handshake packets and PTO probes, and stream data waits
+  ++txStats_.wakeups;
+  const ngtcp2_tstamp nextSendTs =
+      txTimeEnabled_ ? nextSendTs_ : ngtcp2_conn_get_pkt_tx_time(conn_);
+  const bool paced = nextSendTs != UINT64_MAX && nextSendTs > ts;
+  if (!paced) {
+    ev_timer_stop(loop_, &pacingTimer_);
+  } else if (!ev_is_active(&pacingTimer_)) {
+    ++txStats_.pacingWaits;
+    pacingTimer_.repeat =
+        static_cast<ev_tstamp>(nextSendTs - ts) / NGTCP2_SECONDS;
+    ev_timer_again(loop_, &pacingTimer_);
+  }
+
+  // the buffer leaves room for PMTU probes up to the configured maximum,
+  // regular packets are shaped by ngtcp2 to the size validated on the path
+  const size_t payloadSize =
+      std::min(ngtcp2_conn_get_max_tx_udp_payload_size(conn_), payloadLimit_);
+  const size_t pathPayloadSize = std::min(
+      ngtcp2_conn_get_path_max_tx_udp_payload_size(conn_), payloadLimit_);
   ngtcp2_pkt_info packetInfo;
   ngtcp2_path_storage pathStorage;
   int64_t streamId{-1};
   int finish{0};
-  std::array<uint8_t, 65535> buffer;
   size_t pkts{0};
+  size_t bytesSent{0};
+
+  // with kernel pacing the departure times spread a burst out, so bursts
+  // are bounded by the horizon and by what a single flush can carry
+  const size_t maxBurstPackets =
+      txTimeEnabled_ ? kMaxBatchPackets : config_.maxBurstPackets;
 
   ngtcp2_path_storage_zero(&pathStorage);
 
   for (;;) {
     std::array<ngtcp2_vec, 16> datavec;
     size_t datavecCount{0};
-    datavecCount = getBuffer(streamId, finish, datavec.data(), datavec.size());
+    if (paced) {
+      streamId = -1;
+      finish = 0;
+    } else {
+      datavecCount =
+          getBuffer(streamId, finish, datavec.data(), datavec.size());
+    }
 
     uint32_t flags = NGTCP2_WRITE_STREAM_FLAG_MORE;
     if (finish) {
@@ -427,7 +784,7 @@ int QuicConnection::onWrite() {
         conn_,
         &pathStorage.path,
         &packetInfo,
-        buffer.data(),
+        txBuffer_.data() + txLength_,
         payloadSize,
         &appWrite,
         flags,
@@ -445,6 +802,7 @@ int QuicConnection::onWrite() {
           }
           continue;
         case NGTCP2_ERR_STREAM_DATA_BLOCKED:
+          ++flowControlStats_.streamBlocked;
           if (callbacks_.onStreamBlocked) {
             callbacks_.onStreamBlocked(streamId, callbacks_.context);
           }
@@ -456,31 +814,60 @@ int QuicConnection::onWrite() {
           ngtcp2_connection_close_error_set_transport_error_liberr(
               &lastError_, static_cast<int>(totalWrite), nullptr, 0);
           disconnect();
+          return -1;
       }
     }
 
     if (totalWrite == 0) {
-      ngtcp2_conn_update_pkt_tx_time(conn_, ts);
-      return 0;
+      flushPackets();
+      // packets sent before the slot must not move it
+      if (bytesSent && !paced) {
+        schedulePacing(ts);
+      }
+      break;
     }
 
     if (appWrite > 0) {
       if (callbacks_.onStreamDataFramed) {
         callbacks_.onStreamDataFramed(streamId, appWrite, callbacks_.context);
       }
+    } else if (datavecCount && !ngtcp2_conn_get_max_data_left(conn_)) {
+      // stream data is waiting but the peer has not granted connection credit
+      ++flowControlStats_.connectionBlocked;
     }
 
-    auto error = sendPacket(buffer.data(), static_cast<size_t>(totalWrite));
-    if (error != NetworkError::ok) {
-      break;
+    const size_t packetSize = static_cast<size_t>(totalWrite);
+    queuePacket(packetSize, packetInfo.ecn);
+    trackEcnValidation(packetInfo.ecn, ts);
+    bytesSent += packetSize;
+    if (packetSize > pathPayloadSize) {
+      ++pmtudStats_.probesSent;
     }
 
-    // Packet Pacing: Quic recommends against sending traffic
-    // in bursts. This implementationadds a short delay between
-    // outgoing data
-    if (++pkts == kSendBatchSize) {
-      ngtcp2_conn_update_pkt_tx_time(conn_, ts);
-      ev_io_start(loop_, &writeEv_);
+    // a GSO batch is a run of path-size packets and a short packet or a
+    // PMTU probe ends it. Either kind of batch is also bounded by the
+    // buffer and message limits
+    const bool batchFull = (gsoEnabled_ && packetSize != pathPayloadSize) ||
+        txPackets_.size() >= kMaxBatchPackets ||
+        txLength_ + payloadSize > txBuffer_.size();
+    const bool horizonReached = txTimeEnabled_ &&
+        std::max<uint64_t>(txTime_, ts) + pacingInterval(txLength_) >=
+            ts + kTxTimeHorizon;
+    const bool burstDone = ++pkts == maxBurstPackets || horizonReached;
+
+    if (batchFull || burstDone) {
+      if (flushPackets() != NetworkError::ok) {
+        break;
+      }
+    }
+
+    // wait for the next send slot before releasing more packets
+    if (burstDone) {
+      if (!paced) {
+        ++txStats_.bursts;
+        schedulePacing(ts);
+        scheduleWrite();
+      }
       break;
     }
   }
@@ -489,69 +876,139 @@ int QuicConnection::onWrite() {
 }
 
 int QuicConnection::onRead() {
-  std::array<uint8_t, 65536> buffer;
-  struct sockaddr_storage addr;
-  iovec io = {buffer.data(), buffer.size()};
-  msghdr msg{};
-
-  ngtcp2_path path;
-  ngtcp2_pkt_info packetInfo;
-
-  msg.msg_name = &addr;
-  msg.msg_iov = &io;
-  msg.msg_iovlen = 1;
-  msg.msg_namelen = sizeof(addr);
-
-  ssize_t nRead{0};
   for (;;) {
-    nRead = recvmsg(fd_, &msg, MSG_DONTWAIT);
+    for (size_t i = 0; i < kRxBatchSize; ++i) {
+      rxIovecs_[i] = {rxBuffer_.data() + i * kRxBufferSize, kRxBufferSize};
+      auto& msg = rxMmsgs_[i].msg_hdr;
+      msg = msghdr{};
+      msg.msg_name = &rxAddresses_[i];
+      msg.msg_namelen = sizeof(rxAddresses_[i]);
+      msg.msg_iov = &rxIovecs_[i];
+      msg.msg_iovlen = 1;
+      msg.msg_control = rxControl_.data() + i * kRxControlSize;
+      msg.msg_controllen = kRxControlSize;
+    }
+
+    const int nRead = recvmmsg(
+        fd_, rxMmsgs_.data(), kRxBatchSize, MSG_DONTWAIT, nullptr);
+    ++rxStats_.syscalls;
 
     if (nRead == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
       if (errno != EAGAIN && errno != EWOULDBLOCK) {
-        std::cerr << "recvmsg error " << strerror(errno) << std::endl;
+        std::cerr << "recvmmsg error " << strerror(errno) << std::endl;
         disconnect();
       }
       break;
     }
 
-    path.local.addrlen = localAddress_.len;
-    path.local.addr = const_cast<sockaddr*>(&localAddress_.su.sa);
+    const auto batchSize = static_cast<uint64_t>(nRead);
+    ++rxStats_.batches;
+    rxStats_.maxBatch = std::max(rxStats_.maxBatch, batchSize);
+
+    // one timestamp is good enough for every datagram of a batch
+    const ngtcp2_tstamp ts = timestamp();
+
+    for (size_t i = 0; i < batchSize; ++i) {
+      auto& msg = rxMmsgs_[i].msg_hdr;
+      const auto* data = static_cast<uint8_t*>(msg.msg_iov->iov_base);
+      const size_t length = rxMmsgs_[i].msg_len;
+
+      // with UDP_GRO the kernel reports the size of the coalesced
+      // datagrams, all but the last of which have exactly that size
+      size_t segmentSize = length;
+#ifdef UDP_GRO
+      for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+           cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+          int groSize{0};
+          std::memcpy(&groSize, CMSG_DATA(cmsg), sizeof(groSize));
+          if (groSize > 0) {
+            segmentSize = static_cast<size_t>(groSize);
+          }
+        }
+      }
+#endif
+
+      const uint8_t ecn = getEcn(msg);
+
+      ngtcp2_path path;
+      path.local.addrlen = localAddress_.len;
+      path.local.addr = const_cast<sockaddr*>(&localAddress_.su.sa);
+      path.remote.addrlen = msg.msg_namelen;
+      path.remote.addr = static_cast<sockaddr*>(msg.msg_name);
+
+      for (size_t offset = 0; offset < length; offset += segmentSize) {
+        const size_t datagramLength = std::min(segmentSize, length - offset);
+        ++rxStats_.datagrams;
+        if (segmentSize != length) {
+          ++rxStats_.groSegments;
+        }
+        if (readPacket(path, data + offset, datagramLength, ecn, ts)) {
+          return -1;
+        }
+      }
+    }
 
-    path.remote.addrlen = msg.msg_namelen;
-    path.remote.addr = static_cast<sockaddr*>(msg.msg_name);
+    // a short batch means the socket has been drained
+    if (batchSize < kRxBatchSize) {
+      break;
+    }
+  }
+  updateTimer();
+  return 0;
+}
 
-    int error = ngtcp2_conn_read_pkt(
-        conn_,
-        &path,
-        &packetInfo,
-        buffer.data(),
-        static_cast<size_t>(nRead),
-        timestamp());
-
-    if (error) {
-      std::cerr << logtimestamp() << "ngtcp2_conn_read_pkt "
-                << ngtcp2_strerror(error) << std::endl;
-      switch (error) {
-        case NGTCP2_ERR_REQUIRED_TRANSPORT_PARAM:
-        case NGTCP2_ERR_MALFORMED_TRANSPORT_PARAM:
-        case NGTCP2_ERR_TRANSPORT_PARAM:
-        case NGTCP2_ERR_PROTO:
+int QuicConnection::readPacket(
+    const ngtcp2_path& path,
+    const uint8_t* data,
+    size_t datalength,
+    uint8_t ecn,
+    ngtcp2_tstamp ts) {
+  ngtcp2_pkt_info packetInfo{ecn};
+
+  switch (ecn) {
+    case NGTCP2_ECN_ECT_0:
+      ecnStats_.receivedEct0.fetch_add(1, std::memory_order_relaxed);
+      break;
+    case NGTCP2_ECN_ECT_1:
+      ecnStats_.receivedEct1.fetch_add(1, std::memory_order_relaxed);
+      break;
+    case NGTCP2_ECN_CE:
+      ecnStats_.receivedCe.fetch_add(1, std::memory_order_relaxed);
+      break;
+    default:
+      ecnStats_.receivedNotEct.fetch_add(1, std::memory_order_relaxed);
+      break;
+  }
+
+  int error =
+      ngtcp2_conn_read_pkt(conn_, &path, &packetInfo, data, datalength, ts);
+
+  if (error) {
+    std::cerr << logtimestamp() << "ngtcp2_conn_read_pkt "
+              << ngtcp2_strerror(error) << std::endl;
+    switch (error) {
+      case NGTCP2_ERR_REQUIRED_TRANSPORT_PARAM:
+      case NGTCP2_ERR_MALFORMED_TRANSPORT_PARAM:
+      case NGTCP2_ERR_TRANSPORT_PARAM:
+      case NGTCP2_ERR_PROTO:
+        ngtcp2_connection_close_error_set_transport_error_liberr(
+            &lastError_, error, nullptr, 0);
+        disconnect();
+        break;
+      default:
+        if (lastError_.error_code) {
           ngtcp2_connection_close_error_set_transport_error_liberr(
               &lastError_, error, nullptr, 0);
           disconnect();
-          break;
-        default:
-          if (lastError_.error_code) {
-            ngtcp2_connection_close_error_set_transport_error_liberr(
-                &lastError_, error, nullptr, 0);
-            disconnect();
-          }
-          break;
-      }
-      return -1;
+        }
+        break;
     }
+    return -1;
   }
-  updateTimer();
   return 0;
 }
 
@@ -567,6 +1024,7 @@ NetworkError QuicConnection::sendPacket(
 
   do {
     nWrite = sendmsg(fd_, &msg, 0);
+    ++txStats_.syscalls;
   } while (nWrite == -1 && errno == EINTR);
 
   if (nWrite == -1) {
@@ -580,6 +1038,249 @@ NetworkError QuicConnection::sendPacket(
   }
 
   assert(static_cast<size_t>(nWrite) == datalength);
+  ++txStats_.packets;
+  return NetworkError::ok;
+}
+
+void QuicConnection::queuePacket(size_t datalength, uint8_t ecn) {
+  txPackets_.push_back(
+      TxPacket{iovec{txBuffer_.data() + txLength_, datalength}, ecn});
+  txLength_ += datalength;
+}
+
+void QuicConnection::countSentEcn(uint8_t ecn, uint64_t packets) {
+  switch (ecn) {
+    case NGTCP2_ECN_ECT_0:
+      ecnStats_.sentEct0.fetch_add(packets, std::memory_order_relaxed);
+      break;
+    case NGTCP2_ECN_ECT_1:
+      ecnStats_.sentEct1.fetch_add(packets, std::memory_order_relaxed);
+      break;
+    default:
+      ecnStats_.sentNotEct.fetch_add(packets, std::memory_order_relaxed);
+      break;
+  }
+}
+
+void QuicConnection::trackEcnValidation(uint8_t ecn, ngtcp2_tstamp ts) {
+  if (ecn != NGTCP2_ECN_NOT_ECT) {
+    ecnUnmarkedSince_ = 0;
+    if (++ecnMarkedRun_ > kEcnTestingPackets) {
+      ecnStats_.validation.store(RUSH_ECN_CAPABLE, std::memory_order_relaxed);
+    }
+    return;
+  }
+
+  // an unmarked packet, e.g. a PMTU probe, does not fail a validated path
+  // by itself, only marking stopping for longer than ngtcp2 waits for the
+  // test packets' acknowledgements
+  ecnMarkedRun_ = 0;
+  if (!ecnUnmarkedSince_) {
+    ecnUnmarkedSince_ = ts;
+  } else if (
+      ts - ecnUnmarkedSince_ > kEcnFailedPtos * ngtcp2_conn_get_pto(conn_)) {
+    ecnStats_.validation.store(RUSH_ECN_FAILED, std::memory_order_relaxed);
+  }
+}
+
+void QuicConnection::getEcnStats(RushEcnStats& stats) const {
+  stats.sentNotEct = ecnStats_.sentNotEct.load(std::memory_order_relaxed);
+  stats.sentEct0 = ecnStats_.sentEct0.load(std::memory_order_relaxed);
+  stats.sentEct1 = ecnStats_.sentEct1.load(std::memory_order_relaxed);
+  stats.receivedNotEct =
+      ecnStats_.receivedNotEct.load(std::memory_order_relaxed);
+  stats.receivedEct0 = ecnStats_.receivedEct0.load(std::memory_order_relaxed);
+  stats.receivedEct1 = ecnStats_.receivedEct1.load(std::memory_order_relaxed);
+  stats.receivedCe = ecnStats_.receivedCe.load(std::memory_order_relaxed);
+  stats.validation = ecnStats_.validation.load(std::memory_order_relaxed);
+}
+
+void QuicConnection::onPacketTooBig(size_t datalength) {
+  if (datalength > ngtcp2_conn_get_path_max_tx_udp_payload_size(conn_)) {
+    // a PMTU probe beyond what the interface allows. ngtcp2 declares the
+    // probe lost and settles on the last acknowledged size
+    ++pmtudStats_.probesRejected;
+    return;
+  }
+
+  // the path shrank below a size that was already validated. The packet is
+  // lost and its frames are retransmitted by ngtcp2, but later packets are
+  // written to fit the MTU the kernel now reports
+  if (datalength <= kMinUdpPayloadSize) {
+    return;
+  }
+  const int family = remoteAddress_.su.storage.ss_family;
+  // IP and UDP header sizes
+  const size_t headers = family == AF_INET6 ? 48 : 28;
+  const size_t mtu = getPathMtu(fd_, family);
+  const size_t limit = mtu > headers ? mtu - headers : kMinUdpPayloadSize;
+  payloadLimit_ = std::max<size_t>(
+      std::min(limit, datalength - 1), kMinUdpPayloadSize);
+  ++pmtudStats_.sizeReductions;
+  std::cerr << logtimestamp() << "Datagram of " << datalength
+            << " bytes too big, limiting payload to " << payloadLimit_
+            << std::endl;
+}
+
+NetworkError QuicConnection::flushPackets() {
+  NetworkError error{NetworkError::ok};
+  while (error == NetworkError::ok && txSent_ < txPackets_.size()) {
+    error = gsoEnabled_ ? sendGsoBatch() : sendMmsgBatch();
+  }
+
+  if (error == NetworkError::sendBlocked) {
+    // keep the unsent tail of the batch and retry once writable
+    ++txStats_.blocked;
+    ev_io_start(loop_, &writeEv_);
+    return error;
+  }
+
+  txPackets_.clear();
+  txSent_ = 0;
+  txLength_ = 0;
+  return error;
+}
+
+NetworkError QuicConnection::sendGsoBatch() {
+  // a GSO send carries a run of same-size packets sharing an ECN codepoint,
+  // only the last packet of the run may be shorter
+  const auto& first = txPackets_[txSent_];
+  const size_t segmentSize = first.io.iov_len;
+  size_t count{1};
+  size_t datalength{segmentSize};
+  // a super-packet leaves at a single departure time, with kernel pacing it
+  // is kept to one burst so that fq does not release a batch at line rate
+  const size_t maxSegments =
+      txTimeEnabled_ ? config_.maxBurstPackets : kMaxBatchPackets;
+  while (txSent_ + count < txPackets_.size() && count < maxSegments) {
+    const auto& packet = txPackets_[txSent_ + count];
+    if (packet.ecn != first.ecn || packet.io.iov_len > segmentSize ||
+        txPackets_[txSent_ + count - 1].io.iov_len != segmentSize) {
+      break;
+    }
+    datalength += packet.io.iov_len;
+    ++count;
+  }
+
+  iovec io{first.io.iov_base, datalength};
+  msghdr msg{};
+  msg.msg_iov = &io;
+  msg.msg_iovlen = 1;
+
+  alignas(cmsghdr) std::array<uint8_t, CMSG_SPACE(sizeof(uint16_t)) +
+                                          kTxControlSize> control{};
+  msg.msg_control = control.data();
+  msg.msg_controllen = 0;
+
+#ifdef UDP_SEGMENT
+  if (count > 1) {
+    const auto gsoSize = static_cast<uint16_t>(segmentSize);
+    std::memcpy(
+        appendCmsg(msg, SOL_UDP, UDP_SEGMENT, sizeof(gsoSize)),
+        &gsoSize,
+        sizeof(gsoSize));
+  }
+#endif
+  if (first.ecn != NGTCP2_ECN_NOT_ECT) {
+    appendEcnCmsg(msg, remoteAddress_.su.storage.ss_family, first.ecn);
+  }
+  if (txTimeEnabled_) {
+    appendTxTimeCmsg(msg, departureTime(datalength));
+  }
+  if (!msg.msg_controllen) {
+    msg.msg_control = nullptr;
+  }
+
+  ssize_t nWrite{0};
+
+  do {
+    nWrite = sendmsg(fd_, &msg, 0);
+    ++txStats_.syscalls;
+  } while (nWrite == -1 && errno == EINTR);
+
+  if (nWrite == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return NetworkError::sendBlocked;
+    }
+    if (count > 1 &&
+        (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+      // the kernel or the NIC rejected segmentation offload for this
+      // socket. Stop using it and send the batch with sendmmsg instead
+      std::cerr << logtimestamp() << "UDP GSO unavailable ["
+                << strerror(errno) << "], falling back to sendmmsg"
+                << std::endl;
+      gsoEnabled_ = false;
+      return sendMmsgBatch();
+    }
+    if (errno == EMSGSIZE) {
+      onPacketTooBig(segmentSize);
+      txSent_ += count;
+      return NetworkError::ok;
+    }
+    return NetworkError::fatalError;
+  }
+
+  assert(static_cast<size_t>(nWrite) == datalength);
+  txSent_ += count;
+  txStats_.packets += count;
+  countSentEcn(first.ecn, count);
+  if (count > 1) {
+    ++txStats_.gsoBatches;
+  }
+  return NetworkError::ok;
+}
+
+NetworkError QuicConnection::sendMmsgBatch() {
+  const int family = remoteAddress_.su.storage.ss_family;
+  while (txSent_ < txPackets_.size()) {
+    const size_t count =
+        std::min(txPackets_.size() - txSent_, mmsgs_.size());
+    for (size_t i = 0; i < count; ++i) {
+      auto& packet = txPackets_[txSent_ + i];
+      auto& msg = mmsgs_[i].msg_hdr;
+      mmsgs_[i] = mmsghdr{};
+      msg.msg_iov = &packet.io;
+      msg.msg_iovlen = 1;
+      msg.msg_control = txControl_.data() + i * kTxControlSize;
+      if (packet.ecn != NGTCP2_ECN_NOT_ECT) {
+        appendEcnCmsg(msg, family, packet.ecn);
+      }
+      if (txTimeEnabled_) {
+        appendTxTimeCmsg(msg, departureTime(packet.io.iov_len));
+      }
+      if (!msg.msg_controllen) {
+        msg.msg_control = nullptr;
+      }
+    }
+
+    int nSent{0};
+
+    do {
+      nSent = sendmmsg(fd_, mmsgs_.data(), static_cast<unsigned>(count), 0);
+      ++txStats_.syscalls;
+    } while (nSent == -1 && errno == EINTR);
+
+    if (nSent == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return NetworkError::sendBlocked;
+      }
+      if (errno == EMSGSIZE) {
+        // drop the oversized packet, ngtcp2 declares it lost later
+        onPacketTooBig(txPackets_[txSent_].io.iov_len);
+        ++txSent_;
+        continue;
+      }
+      return NetworkError::fatalError;
+    }
+
+    // a partial send leaves the remaining messages for the next
+    // iteration, which either sends them or reports why it cannot
+    for (int i = 0; i < nSent; ++i) {
+      countSentEcn(txPackets_[txSent_++].ecn, 1);
+    }
+    txStats_.packets += static_cast<uint64_t>(nSent);
+    ++txStats_.mmsgBatches;
+  }
   return NetworkError::ok;
 }
 
@@ -655,12 +1356,16 @@ int QuicConnection::disconnect() {
   ev_io_stop(loop_, &readEv_);
   ev_timer_stop(loop_, &timer_);
   ev_timer_stop(loop_, &statsTimer_);
+  ev_timer_stop(loop_, &pacingTimer_);
 
   changeState(ConnectionState::Stopped);
-  ev_break(loop_, EVBREAK_ALL);
 
   close(fd_);
 
+  if (callbacks_.onConnectionClosed) {
+    callbacks_.onConnectionClosed(callbacks_.context);
+  }
+
   return 0;
 }
 
@@ -682,6 +1387,54 @@ void QuicConnection::printStats() {
   ngtcp2_conn_get_conn_stat(conn_, &stat);
   std::cout << "Bits per second   " << stat.delivery_rate_sec * 8 << std::endl;
   std::cout << "Congestion Window " << stat.cwnd << std::endl;
+  std::cout << "Packets sent      " << txStats_.packets << " in "
+            << txStats_.syscalls << " syscalls (" << txStats_.gsoBatches
+            << " GSO batches, " << txStats_.mmsgBatches
+            << " sendmmsg batches" << (gsoEnabled_ ? "" : ", GSO off")
+            << ", blocked " << txStats_.blocked << ")" << std::endl;
+  std::cout << "Flow control      blocked by peer: stream "
+            << flowControlStats_.streamBlocked << " connection "
+            << flowControlStats_.connectionBlocked << ", receive window "
+            << connectionWindow_ << " (" << flowControlStats_.windowUpdates
+            << " increases)" << std::endl;
+  std::cout << "Path MTU          max payload "
+            << std::min(
+                   ngtcp2_conn_get_path_max_tx_udp_payload_size(conn_),
+                   payloadLimit_)
+            << ", probes sent " << pmtudStats_.probesSent << " rejected "
+            << pmtudStats_.probesRejected << ", size reductions "
+            << pmtudStats_.sizeReductions << std::endl;
+  std::cout << "Pacing rate       " << stat.pacing_rate * NGTCP2_SECONDS * 8
+            << " bps, " << txStats_.bursts << " full bursts of "
+            << config_.maxBurstPackets << ", " << txStats_.pacingWaits
+            << " pacing waits" << (txTimeEnabled_ ? ", SO_TXTIME" : "")
+            << std::endl;
+
+  // CPU used by the event-loop thread, to compare pacing modes
+  rusage usage{};
+  getrusage(RUSAGE_THREAD, &usage);
+  const auto cpuMicros = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+          1000000 +
+      usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+  std::cout << "Loop thread CPU   " << cpuMicros / 1000 << " ms in "
+            << txStats_.wakeups << " write wakeups" << std::endl;
+  std::cout << "Packets received  " << rxStats_.datagrams << " in "
+            << rxStats_.syscalls << " syscalls (" << rxStats_.batches
+            << " batches, avg "
+            << (rxStats_.batches ? rxStats_.datagrams / rxStats_.batches : 0)
+            << " max " << rxStats_.maxBatch << " per batch, "
+            << rxStats_.groSegments << " GRO segments"
+            << (groEnabled_ ? "" : ", GRO off") << ")" << std::endl;
+  RushEcnStats ecn;
+  getEcnStats(ecn);
+  static constexpr const char* kEcnValidation[] = {
+      "testing", "capable", "failed"};
+  std::cout << "ECN sent          ECT(0) " << ecn.sentEct0 << " ECT(1) "
+            << ecn.sentEct1 << " not-ECT " << ecn.sentNotEct << ", "
+            << kEcnValidation[ecn.validation] << std::endl;
+  std::cout << "ECN received      ECT(0) " << ecn.receivedEct0 << " ECT(1) "
+            << ecn.receivedEct1 << " CE " << ecn.receivedCe << " not-ECT "
+            << ecn.receivedNotEct << std::endl;
   ev_timer_again(loop_, &statsTimer_);
 }
 
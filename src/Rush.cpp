@@ -7,16 +7,63 @@
 // LICENSE file in the root directory of this source tree.
 
 #include <Rush.h>
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 
+#include "CodecUtils.h"
 #include "RushClient.h"
 #include "RushMuxer.h"
+#include "RushRuntime.h"
+#include "SessionCache.h"
+#include "TransportConfig.h"
 
 using namespace rush;
 
+void getDefaultTransportConfig(RushTransportConfig* config) {
+  assert(config);
+  *config = rush::getDefaultTransportConfig();
+}
+
 RushClientHandle createClient() {
-  return new RushClient();
+  return new RushClient(rush::getDefaultTransportConfig());
+}
+
+RushClientHandle createClientWithConfig(const RushTransportConfig* config) {
+  if (!config || rush::validateTransportConfig(*config)) {
+    return nullptr;
+  }
+  if (config->sessionCacheFile) {
+    rush::SessionCache::getInstance().setFile(config->sessionCacheFile);
+  }
+  return new RushClient(*config);
+}
+
+RushRuntimeHandle createRuntime(int threads) {
+  return new RushRuntime(static_cast<size_t>(std::max(threads, 0)));
+}
+
+void destroyRuntime(RushRuntimeHandle handle) {
+  if (!handle) {
+    return;
+  }
+  delete handle;
+}
+
+RushClientHandle createClientWithRuntime(
+    RushRuntimeHandle runtime,
+    const RushTransportConfig* config) {
+  assert(runtime);
+  if (!config) {
+    return new RushClient(rush::getDefaultTransportConfig(), runtime);
+  }
+  if (rush::validateTransportConfig(*config)) {
+    return nullptr;
+  }
+  if (config->sessionCacheFile) {
+    rush::SessionCache::getInstance().setFile(config->sessionCacheFile);
+  }
+  return new RushClient(*config, runtime);
 }
 
 int connectTo(RushClientHandle handle, const char* host, int port) {
@@ -27,6 +74,58 @@ int sendMessage(RushClientHandle handle, const uint8_t* data, int size) {
   return handle->sendMessage(data, size);
 }
 
+int sendMessageV(RushClientHandle handle, const struct iovec* iov, int iovcnt) {
+  if (iovcnt < 0) {
+    return -1;
+  }
+  return handle->sendMessageV(iov, static_cast<size_t>(iovcnt));
+}
+
+void setWritableCallback(
+    RushClientHandle handle,
+    RushWritableCallback callback,
+    void* opaque) {
+  assert(handle);
+  handle->setWritableCallback(callback, opaque);
+}
+
+void setFrameDeliveredCallback(
+    RushClientHandle handle,
+    RushFrameDeliveredCallback callback,
+    void* opaque) {
+  assert(handle);
+  handle->setFrameDeliveredCallback(callback, opaque);
+}
+
+uint32_t getQueuedMs(RushClientHandle handle) {
+  assert(handle);
+  return handle->getQueuedMs();
+}
+
+int getEcnStats(RushClientHandle handle, RushEcnStats* stats) {
+  assert(handle);
+  assert(stats);
+  return handle->getEcnStats(*stats);
+}
+
+void setVideoTrackWeight(
+    RushClientHandle handle,
+    uint8_t trackId,
+    uint32_t weight) {
+  assert(handle);
+  handle->setVideoTrackWeight(trackId, weight);
+}
+
+int sendMessageZeroCopy(
+    RushClientHandle handle,
+    const uint8_t* data,
+    size_t size,
+    RushReleaseCallback release,
+    void* opaque) {
+  assert(release);
+  return handle->sendMessageZeroCopy(data, size, release, opaque);
+}
+
 void destroyClient(RushClientHandle handle) {
   if (!handle) {
     return;
@@ -157,3 +256,64 @@ ssize_t
 endOfStreamFrame(RushMuxerHandle handle, uint8_t* buffer, int bufLength) {
   return handle->endOfStreamFrame(buffer, bufLength);
 }
+
+int rushSendVideoFrame(
+    RushClientHandle client,
+    RushMuxerHandle muxer,
+    uint8_t codec,
+    uint8_t index,
+    int isKeyFrame,
+    uint8_t* data,
+    int length,
+    uint64_t pts,
+    uint64_t dts,
+    uint8_t* extradata,
+    int extradataLength) {
+  assert(client && muxer);
+  // the muxer assigns sequence ids and key frame references, so it only
+  // sees frames the client accepts. The reservation covers the extradata
+  // even when the frame leaves it out
+  if (int error = client->reserveFrame(getRushFrameSize(
+          static_cast<size_t>(length),
+          static_cast<size_t>(extradataLength)))) {
+    return error;
+  }
+  const auto frame = muxer->makeVideoWithTrackFrame(
+      static_cast<VideoCodec>(codec),
+      index,
+      isKeyFrame <= 0 ? false : true,
+      data,
+      length,
+      pts,
+      dts,
+      extradata,
+      extradataLength);
+  return client->sendFrame(frame);
+}
+
+int rushSendAudioFrame(
+    RushClientHandle client,
+    RushMuxerHandle muxer,
+    uint8_t codec,
+    uint8_t index,
+    uint8_t* data,
+    int length,
+    uint64_t pts,
+    uint8_t* extradata,
+    int extradataLength) {
+  assert(client && muxer);
+  if (int error = client->reserveFrame(getRushFrameSize(
+          static_cast<size_t>(length),
+          static_cast<size_t>(extradataLength)))) {
+    return error;
+  }
+  const auto frame = muxer->makeAudioWithTrackFrame(
+      static_cast<AudioCodec>(codec),
+      index,
+      data,
+      length,
+      pts,
+      extradata,
+      extradataLength);
+  return client->sendFrame(frame);
+}
@@ -21,6 +21,13 @@ using namespace rush;
 
 static constexpr uint32_t kConnectAckTimeoutSeconds = 10;
 
+// bytes a video track may write per unit of weight in its round-robin turn,
+// about one packet
+static constexpr int64_t kSchedulerQuantum = 1200;
+
+// keys of audio tracks in trackStreams_, video tracks use the bare track id
+static constexpr uint16_t kAudioTrackKey = 0x100;
+
 namespace {
 
 static size_t onSocketWriteable(
@@ -63,6 +70,21 @@ static int bindStream(std::unique_ptr<Stream>&& stream, void* context) {
   return client->bindStream(std::move(stream));
 }
 
+static int onExtendMaxStreamsUni(void* context) {
+  const auto client = static_cast<RushClient*>(context);
+  return client->onExtendMaxStreamsUni();
+}
+
+static int onStreamClosed(int64_t streamId, void* context) {
+  const auto client = static_cast<RushClient*>(context);
+  return client->onStreamClosed(streamId);
+}
+
+static int onEarlyDataRejected(void* context) {
+  const auto client = static_cast<RushClient*>(context);
+  return client->onEarlyDataRejected();
+}
+
 static int onStreamBlocked(int64_t streamId, void* context) {
   const auto client = static_cast<RushClient*>(context);
   return client->onStreamBlocked(streamId);
@@ -73,8 +95,57 @@ static int onExtendStreamMaxData(int64_t streamId, void* context) {
   return client->onExtendStreamMaxData(streamId);
 }
 
+static void onConnectionClosed(void* context) {
+  const auto client = static_cast<RushClient*>(context);
+  client->onConnectionClosed();
+}
+
+// hands out pool nodes to a Cursor serializing a frame across them
+struct NodeSink final : CursorSink {
+  NodeSink(Pool& pool, std::vector<Pool::Node>& nodes, size_t size)
+      : pool(pool), nodes(nodes), remaining(size) {}
+
+  bool nextSegment(uint8_t*& data, size_t& length) override {
+    nodes.emplace_back(pool.get(remaining));
+    data = nodes.back().data;
+    length = nodes.back().getCapacity();
+    remaining -= std::min(length, remaining);
+    return true;
+  }
+
+  Pool& pool;
+  std::vector<Pool::Node>& nodes;
+  // bytes of the frame not covered by a node yet
+  size_t remaining;
+};
+
 } // namespace
 
+RushClient::RushClient(const RushTransportConfig& config)
+    : pool_(config.hugePages),
+      loop_(std::make_shared<rush::EvLoop>()),
+      config_(config) {}
+
+RushClient::RushClient(const RushTransportConfig& config, RushRuntime* runtime)
+    : pool_(config.hugePages),
+      runtime_(runtime),
+      loop_(runtime->acquireLoop()),
+      config_(config) {}
+
+RushClient::~RushClient() {
+  if (!runtime_) {
+    return;
+  }
+  // the shared loop keeps running, tear the connection down on its thread
+  if (conn_) {
+    loop_->enqueueAndWait([&]() {
+      conn_.reset();
+      return 0;
+    });
+  }
+  runtime_->releaseLoop(loop_);
+}
+
 int RushClient::connect(const char* hostname, int port) {
   Address remoteAddress, localAddress;
   const int fd =
@@ -101,14 +172,26 @@ int RushClient::connect(const char* hostname, int port) {
       .onStreamBlocked = ::onStreamBlocked,
       .onExtendStreamMaxData = ::onExtendStreamMaxData,
       .bindStream = ::bindStream,
+      .onExtendMaxStreamsUni = ::onExtendMaxStreamsUni,
+      .onStreamClosed = ::onStreamClosed,
+      .onEarlyDataRejected = ::onEarlyDataRejected,
+      .onConnectionClosed = ::onConnectionClosed,
       .context = this,
   };
 
   conn_ = std::make_shared<rush::QuicConnection>(
-      loop_->get(), fd, localAddress, remoteAddress, callbacks, connstate_);
+      loop_->get(),
+      fd,
+      localAddress,
+      remoteAddress,
+      callbacks,
+      connstate_,
+      config_);
 
-  std::thread t([=]() { loop_->run(0); });
-  thread_ = std::move(t);
+  if (!runtime_) {
+    std::thread t([=]() { loop_->run(0); });
+    thread_ = std::move(t);
+  }
 
   if (int error = loop_->enqueueAndWait([&]() { return conn_->connect(); })) {
     std::cerr << "Connect failed" << std::endl;
@@ -120,7 +203,8 @@ int RushClient::connect(const char* hostname, int port) {
       lock, [&] { return connstate_->state != ConnectionState::Unset; });
 
   if (connstate_->state != ConnectionState::TransportConnected) {
-    thread_.join();
+    lock.unlock();
+    close();
     return -1;
   }
   return fd;
@@ -131,17 +215,78 @@ size_t RushClient::onSocketWriteable(
     int& finish,
     ngtcp2_vec* vec,
     size_t vecCount) {
-  if (!stream_) {
-    return 0;
+  finish = 0;
+  // control frames on the bidirectional stream go first
+  if (stream_ && !stream_->blocked && stream_->txBuffer->available()) {
+    streamId = stream_->streamID;
+    return stream_->txBuffer->getData(vec, vecCount);
   }
-  if (stream_->blocked) {
+
+  auto* stream = config_.multiStream == RUSH_MULTI_STREAM_TRACK
+      ? nextTrackStream()
+      : nextFrameStream();
+  if (!stream) {
     return 0;
   }
-  if (!stream_->txBuffer->available()) {
-    return 0;
+  streamId = stream->streamID;
+  const size_t count = stream->txBuffer->getData(vec, vecCount);
+  uint64_t offered{0};
+  for (size_t i = 0; i < count; ++i) {
+    offered += vec[i].len;
+  }
+  finish = stream->fin && offered == stream->txBuffer->unsentBytes();
+  return count;
+}
+
+static bool writable(const rush::Stream* stream) {
+  return !stream->blocked && stream->txBuffer->available();
+}
+
+rush::Stream* RushClient::nextFrameStream() {
+  // streams written completely leave the write order
+  while (!writeOrder_.empty() && !writeOrder_.front()->txBuffer->available()) {
+    writeOrder_.pop_front();
+  }
+  for (auto* stream : writeOrder_) {
+    if (writable(stream)) {
+      return stream;
+    }
   }
-  streamId = stream_->streamID;
-  return stream_->txBuffer->getData(vec, vecCount);
+  return nullptr;
+}
+
+rush::Stream* RushClient::nextTrackStream() {
+  for (auto* stream : audioStreams_) {
+    if (writable(stream)) {
+      return stream;
+    }
+  }
+  if (videoTracks_.empty()) {
+    return nullptr;
+  }
+
+  // deficit round-robin: a track keeps its turn while it has data and
+  // credit left, each turn grants it weight * kSchedulerQuantum bytes
+  for (size_t visited = 0; visited <= videoTracks_.size(); ++visited) {
+    auto& track = videoTracks_[nextVideo_];
+    if (!writable(track.stream)) {
+      track.deficit = 0;
+    } else if (track.deficit > 0) {
+      return track.stream;
+    }
+    nextVideo_ = (nextVideo_ + 1) % videoTracks_.size();
+    auto& next = videoTracks_[nextVideo_];
+    next.deficit += next.weight * kSchedulerQuantum;
+  }
+  return nullptr;
+}
+
+rush::Stream* RushClient::findStream(int64_t streamId) {
+  if (stream_ && stream_->streamID == streamId) {
+    return stream_.get();
+  }
+  const auto it = uniStreams_.find(streamId);
+  return it == uniStreams_.end() ? nullptr : it->second.get();
 }
 
 int RushClient::onRecvStreamData(
@@ -194,58 +339,607 @@ int RushClient::onAckedStreamDataOffset(
     int64_t streamId,
     uint64_t offset,
     uint64_t length) {
-  auto nodes = stream_->txBuffer->purge(length);
-  for (auto& node : nodes) {
-    pool_.free(std::move(node));
+  auto* stream = findStream(streamId);
+  if (!stream) {
+    return 0;
   }
+  stream->txBuffer->purge(length, pool_);
+  onFramesAcked(*stream->txBuffer, length);
   return 0;
 }
 
 int RushClient::onStreamDataFramed(int64_t streamId, size_t length) {
-  stream_->txBuffer->moveCursor(length);
+  if (auto* stream = findStream(streamId)) {
+    stream->txBuffer->moveCursor(length);
+  }
+  if (!videoTracks_.empty() &&
+      videoTracks_[nextVideo_].stream->streamID == streamId) {
+    videoTracks_[nextVideo_].deficit -= static_cast<int64_t>(length);
+  }
   return 0;
 }
 
 int RushClient::bindStream(std::unique_ptr<Stream>&& stream) {
+  if (stream_) {
+    // replacement for a rejected 0-RTT stream, keep the queued data
+    stream_->streamID = stream->streamID;
+    stream_->blocked = false;
+    return 0;
+  }
   stream_ = std::move(stream);
   return 0;
 }
 
+int RushClient::onEarlyDataRejected() {
+  if (stream_) {
+    stream_->txBuffer->rewind();
+  }
+  return 0;
+}
+
 int RushClient::onStreamBlocked(int64_t streamId) {
-  stream_->blocked = true;
+  if (auto* stream = findStream(streamId)) {
+    stream->blocked = true;
+  }
   return 0;
 }
 
 int RushClient::onExtendStreamMaxData(int64_t streamId) {
-  stream_->blocked = false;
+  if (auto* stream = findStream(streamId)) {
+    stream->blocked = false;
+  }
+  return 0;
+}
+
+int RushClient::onExtendMaxStreamsUni() {
+  if (!pendingStreams_.empty()) {
+    openUniStreams();
+    updateOldestQueued();
+    conn_->scheduleWrite();
+  }
+  return 0;
+}
+
+int RushClient::onStreamClosed(int64_t streamId) {
+  const auto it = uniStreams_.find(streamId);
+  if (it == uniStreams_.end()) {
+    return 0;
+  }
+  auto stream = std::move(it->second);
+  uniStreams_.erase(it);
+  writeOrder_.erase(
+      std::remove(writeOrder_.begin(), writeOrder_.end(), stream.get()),
+      writeOrder_.end());
+  if (stream->trackKey >= 0) {
+    // the track's next frame opens a new stream
+    removeTrackStream(stream.get());
+  }
+
+  // a reset stream still holds data the server never acknowledged
+  queuedBytes_.fetch_sub(
+      stream->txBuffer->queuedBytes(), std::memory_order_relaxed);
+  recycleStream(std::move(stream));
+
+  updateOldestQueued();
+  notifyWritable();
+  return 0;
+}
+
+void RushClient::recycleStream(std::unique_ptr<rush::Stream> stream) {
+  stream->txBuffer->reset(pool_);
+  stream->streamID = -1;
+  stream->blocked = false;
+  stream->fin = false;
+  stream->trackKey = -1;
+  freeStreams_.push_back(std::move(stream));
+}
+
+void RushClient::dropPendingStream() {
+  auto stream = std::move(pendingStreams_.front());
+  pendingStreams_.pop_front();
+  if (stream->trackKey >= 0) {
+    // the track's next frame opens a new stream
+    removeTrackStream(stream.get());
+  }
+  uint64_t start{0};
+  for (const auto& frame : stream->txBuffer->frames()) {
+    onFrameDropped(frame, frame.end - start);
+    start = frame.end;
+    if (frame.flags & kFrameVideo) {
+      skipUntilKey_.insert(frame.trackId);
+    }
+  }
+  recycleStream(std::move(stream));
+  notifyWritable();
+}
+
+void RushClient::openUniStreams() {
+  while (!pendingStreams_.empty()) {
+    auto& stream = pendingStreams_.front();
+    if (int error = conn_->openUniStream(stream->streamID)) {
+      if (error == NGTCP2_ERR_STREAM_ID_BLOCKED) {
+        ++multiStreamStats_.creditWaits;
+        return;
+      }
+      // waiting would hold back every later frame for good
+      std::cerr << "Could not open stream " << ngtcp2_strerror(error)
+                << ", dropping its frames" << std::endl;
+      dropPendingStream();
+      continue;
+    }
+    ++multiStreamStats_.opened;
+    if (stream->trackKey < 0) {
+      writeOrder_.push_back(stream.get());
+    } else if (stream->trackKey & kAudioTrackKey) {
+      audioStreams_.push_back(stream.get());
+    } else {
+      const auto weight = videoWeights_.find(
+          static_cast<uint8_t>(stream->trackKey));
+      videoTracks_.push_back(VideoTrack{
+          stream.get(),
+          weight == videoWeights_.end() ? 1 : weight->second,
+          0});
+    }
+    uniStreams_.emplace(stream->streamID, std::move(stream));
+    pendingStreams_.pop_front();
+  }
+}
+
+void RushClient::removeTrackStream(rush::Stream* stream) {
+  trackStreams_.erase(static_cast<uint16_t>(stream->trackKey));
+  audioStreams_.erase(
+      std::remove(audioStreams_.begin(), audioStreams_.end(), stream),
+      audioStreams_.end());
+  videoTracks_.erase(
+      std::remove_if(
+          videoTracks_.begin(),
+          videoTracks_.end(),
+          [&](const VideoTrack& track) { return track.stream == stream; }),
+      videoTracks_.end());
+  if (nextVideo_ >= videoTracks_.size()) {
+    nextVideo_ = 0;
+  }
+}
+
+std::unique_ptr<rush::Stream> RushClient::newStream() {
+  if (freeStreams_.empty()) {
+    return std::make_unique<Stream>();
+  }
+  auto stream = std::move(freeStreams_.back());
+  freeStreams_.pop_back();
+  return stream;
+}
+
+void RushClient::updateOldestQueued() {
+  ngtcp2_tstamp oldest = stream_ ? stream_->txBuffer->oldestQueued() : 0;
+
+  if (config_.multiStream == RUSH_MULTI_STREAM_TRACK) {
+    for (const auto& entry : trackStreams_) {
+      const ngtcp2_tstamp track = entry.second->txBuffer->oldestQueued();
+      if (track && (!oldest || track < oldest)) {
+        oldest = track;
+      }
+    }
+    oldestQueuedTs_.store(oldest, std::memory_order_relaxed);
+    return;
+  }
+
+  // stream ids grow in send order, the first stream still holding data
+  // has the oldest media frame. Unopened streams are newer than all others
+  ngtcp2_tstamp media{0};
+  for (const auto& entry : uniStreams_) {
+    if ((media = entry.second->txBuffer->oldestQueued())) {
+      break;
+    }
+  }
+  if (!media && !pendingStreams_.empty()) {
+    media = pendingStreams_.front()->txBuffer->oldestQueued();
+  }
+  if (media && (!oldest || media < oldest)) {
+    oldest = media;
+  }
+  oldestQueuedTs_.store(oldest, std::memory_order_relaxed);
+}
+
+void RushClient::WriteTask::run() {
+  client->writeToBuffer(*this);
+  // keeps the vector's capacity for the next message
+  nodes.clear();
+  client->freeTasks_.push(this);
+}
+
+RushClient::WriteTask* RushClient::getWriteTask() {
+  if (auto* task = freeTasks_.pop()) {
+    return static_cast<WriteTask*>(task);
+  }
+  tasks_.push_back(std::make_unique<WriteTask>(this));
+  return tasks_.back().get();
+}
+
+void RushClient::writeToBuffer(WriteTask& task) {
+  if (skipFrame(task)) {
+    return;
+  }
+  const bool media = task.frame.flags & (kFrameVideo | kFrameAudio);
+  if (config_.multiStream == RUSH_MULTI_STREAM_FRAME && media) {
+    auto stream = newStream();
+    stream->txBuffer->insert(task.nodes, task.frame);
+    stream->fin = true;
+    pendingStreams_.push_back(std::move(stream));
+    openUniStreams();
+  } else if (config_.multiStream == RUSH_MULTI_STREAM_TRACK && media) {
+    // audio and video track ids are numbered separately
+    const uint16_t key = task.frame.trackId |
+        ((task.frame.flags & kFrameAudio) ? kAudioTrackKey : 0);
+    auto& trackStream = trackStreams_[key];
+    if (!trackStream) {
+      auto stream = newStream();
+      stream->trackKey = key;
+      trackStream = stream.get();
+      pendingStreams_.push_back(std::move(stream));
+    }
+    trackStream->txBuffer->insert(task.nodes, task.frame);
+    dropLateFrames(*trackStream->txBuffer);
+    openUniStreams();
+  } else {
+    stream_->txBuffer->insert(task.nodes, task.frame);
+    dropLateFrames(*stream_->txBuffer);
+  }
+  updateOldestQueued();
+  conn_->scheduleWrite();
+}
+
+static_assert(
+    kFrameVideo == RUSH_FRAME_VIDEO && kFrameAudio == RUSH_FRAME_AUDIO &&
+        kFrameKey == RUSH_FRAME_KEY,
+    "frame flags of the C API");
+
+void RushClient::dropLateFrames(Buffer& buffer) {
+  const ngtcp2_tstamp oldest = buffer.oldestUnsent();
+  const ngtcp2_duration budget =
+      config_.maxQueueDelayMs * NGTCP2_MILLISECONDS;
+  if (!config_.maxQueueDelayMs || !oldest || timestamp() - oldest <= budget) {
+    return;
+  }
+
+  // beyond twice the budget whole GOPs are dropped as well, everything of a
+  // track queued before its newest key frame
+  newestKeyFrames_.clear();
+  if (timestamp() - oldest > 2 * budget) {
+    const auto& frames = buffer.frames();
+    for (size_t i = buffer.unstarted(); i < frames.size(); ++i) {
+      if ((frames[i].flags & kFrameVideo) && (frames[i].flags & kFrameKey)) {
+        newestKeyFrames_[frames[i].trackId] = i;
+      }
+    }
+  }
+
+  buffer.dropUnstarted(
+      pool_,
+      [](const FrameEntry& frame, size_t index, void* context) {
+        const auto client = static_cast<RushClient*>(context);
+        if (!(frame.flags & kFrameVideo)) {
+          return false;
+        }
+        bool drop = true;
+        if (frame.flags & kFrameKey) {
+          const auto it = client->newestKeyFrames_.find(frame.trackId);
+          drop = it != client->newestKeyFrames_.end() && index < it->second;
+        }
+        // a frame may reference any earlier one of its GOP, so once one is
+        // dropped the track resumes only at a key frame
+        if (drop) {
+          client->skipUntilKey_.insert(frame.trackId);
+        } else {
+          client->skipUntilKey_.erase(frame.trackId);
+        }
+        return drop;
+      },
+      [](const FrameEntry& frame, uint64_t length, void* context) {
+        static_cast<RushClient*>(context)->onFrameDropped(frame, length);
+      },
+      this);
+  notifyWritable();
+}
+
+bool RushClient::skipFrame(WriteTask& task) {
+  if (!(task.frame.flags & kFrameVideo)) {
+    return false;
+  }
+  const auto it = skipUntilKey_.find(task.frame.trackId);
+  if (it == skipUntilKey_.end()) {
+    return false;
+  }
+  if (task.frame.flags & kFrameKey) {
+    skipUntilKey_.erase(it);
+    return false;
+  }
+  // caller-owned nodes are released once the task clears them
+  for (auto& node : task.nodes) {
+    pool_.free(std::move(node));
+  }
+  onFrameDropped(task.frame, task.length);
+  notifyWritable();
+  return true;
+}
+
+void RushClient::onFrameDropped(const FrameEntry& frame, uint64_t length) {
+  auto& stats = dropStats_[frame.trackId];
+  ++stats.frames;
+  stats.bytes += length;
+  queuedBytes_.fetch_sub(length, std::memory_order_relaxed);
+}
+
+void RushClient::setVideoTrackWeight(uint8_t trackId, uint32_t weight) {
+  videoWeights_[trackId] = std::max<uint32_t>(weight, 1);
+}
+
+void RushClient::setFrameDeliveredCallback(
+    RushFrameDeliveredCallback callback,
+    void* opaque) {
+  deliveredCallback_ = callback;
+  deliveredOpaque_ = opaque;
+}
+
+uint32_t RushClient::getQueuedMs() const {
+  const ngtcp2_tstamp oldest = oldestQueuedTs_.load(std::memory_order_relaxed);
+  if (!oldest) {
+    return 0;
+  }
+  return static_cast<uint32_t>((timestamp() - oldest) / NGTCP2_MILLISECONDS);
+}
+
+int RushClient::getEcnStats(RushEcnStats& stats) const {
+  // conn_ is only reset when the client is destroyed
+  if (!conn_) {
+    return -1;
+  }
+  conn_->getEcnStats(stats);
+  return 0;
+}
+
+void RushClient::setWritableCallback(
+    void (*callback)(void* opaque),
+    void* opaque) {
+  writableCallback_ = callback;
+  writableOpaque_ = opaque;
+}
+
+bool RushClient::withinBudget(size_t length) const {
+  const uint64_t queued = queuedBytes_.load(std::memory_order_relaxed);
+  // a message always fits into an empty queue
+  if (!queued) {
+    return true;
+  }
+  if (config_.maxQueuedBytes && queued + length > config_.maxQueuedBytes) {
+    return false;
+  }
+  const ngtcp2_tstamp oldest = oldestQueuedTs_.load(std::memory_order_relaxed);
+  if (config_.maxQueuedMs && oldest &&
+      timestamp() - oldest > config_.maxQueuedMs * NGTCP2_MILLISECONDS) {
+    return false;
+  }
+  return true;
+}
+
+int RushClient::waitForBudget(size_t length) {
+  if (withinBudget(length)) {
+    return 0;
+  }
+  // flag first and check again, so acks in between cannot miss the flag
+  // and leave the caller without a writable notification. The fences here
+  // and in notifyWritable() keep the flag store and the budget loads of
+  // either side from passing each other
+  wouldBlock_.store(true);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (withinBudget(length)) {
+    wouldBlock_.store(false);
+    return 0;
+  }
+  if (!config_.sendTimeoutMs) {
+    return RUSH_ERR_WOULD_BLOCK;
+  }
+
+  std::unique_lock<std::mutex> lock(budgetMutex_);
+  const bool ready = budgetCv_.wait_for(
+      lock, std::chrono::milliseconds(config_.sendTimeoutMs), [&] {
+        // the loop may have consumed the flag for a smaller budget check
+        wouldBlock_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return withinBudget(length) ||
+            connstate_->state == ConnectionState::Stopped;
+      });
+  if (connstate_->state == ConnectionState::Stopped) {
+    return -1;
+  }
+  if (!ready) {
+    return RUSH_ERR_WOULD_BLOCK;
+  }
+  wouldBlock_.store(false);
   return 0;
 }
 
-void RushClient::writeToBuffer(Pool::Node&& node) {
-  stream_->txBuffer->insert(std::move(node));
+void RushClient::onFramesAcked(Buffer& buffer, uint64_t length) {
+  queuedBytes_.fetch_sub(length, std::memory_order_relaxed);
+  FrameEntry frame;
+  const ngtcp2_tstamp now = timestamp();
+  while (buffer.popDelivered(frame)) {
+    if (deliveredCallback_) {
+      deliveredCallback_(
+          frame.sequenceId,
+          frame.trackId,
+          frame.flags,
+          static_cast<uint32_t>(
+              (now - frame.enqueueTs) / NGTCP2_MILLISECONDS),
+          deliveredOpaque_);
+    }
+  }
+  updateOldestQueued();
+  notifyWritable();
+}
+
+void RushClient::notifyWritable() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!wouldBlock_.load() || !withinBudget(0)) {
+    return;
+  }
+  wouldBlock_.store(false);
+  {
+    // pairs with the waiter's predicate check
+    std::lock_guard<std::mutex> guard(budgetMutex_);
+  }
+  budgetCv_.notify_all();
+  if (writableCallback_) {
+    writableCallback_(writableOpaque_);
+  }
 }
 
 int RushClient::sendMessage(const uint8_t* data, size_t size) {
+  const iovec io{const_cast<uint8_t*>(data), size};
+  return sendMessageV(&io, 1);
+}
+
+int RushClient::sendMessageV(const iovec* io, size_t count) {
   const auto state = connstate_->state.load(std::memory_order_relaxed);
   if (state != ConnectionState::TransportConnected &&
       state != ConnectionState::BroadcastAccepted) {
     return -1;
   }
-  size_t written{0};
-  while (written < size) {
-    auto node = std::move(pool_.get());
-    const size_t towrite = std::min(node.getCapacity(), (size - written));
-    std::memcpy(node.data, data + written, towrite);
-    node.length = towrite;
-    loop_->enqueue([&, node = std::move(node)]() mutable {
-      this->writeToBuffer(std::move(node));
-    });
-    written += towrite;
+  size_t remaining{0};
+  for (size_t i = 0; i < count; ++i) {
+    remaining += io[i].iov_len;
   }
+  if (int error = waitForBudget(remaining)) {
+    return error;
+  }
+
+  // the message is packed into a chain of nodes handed over at once
+  auto* task = getWriteTask();
+  for (size_t i = 0; i < count; ++i) {
+    const auto* data = static_cast<const uint8_t*>(io[i].iov_base);
+    size_t written{0};
+    while (written < io[i].iov_len) {
+      if (task->nodes.empty() ||
+          task->nodes.back().length == task->nodes.back().getCapacity()) {
+        task->nodes.emplace_back(pool_.get(remaining));
+      }
+      auto& node = task->nodes.back();
+      const size_t towrite =
+          std::min(node.getCapacity() - node.length, io[i].iov_len - written);
+      std::memcpy(node.data + node.length, data + written, towrite);
+      node.length += towrite;
+      written += towrite;
+      remaining -= towrite;
+    }
+  }
+  return queueMessage(task);
+}
 
-  // TODO Add support for chunked frames. The current implementation assumes
-  // sendMessage is called once per frame and does not support frame
-  // fragmentation Add an implementation to keep track of frame boundaries
+int RushClient::sendMessageZeroCopy(
+    const uint8_t* data,
+    size_t size,
+    void (*release)(void* opaque),
+    void* opaque) {
+  // an empty node would stay available to write forever
+  if (!size) {
+    return -1;
+  }
+  const auto state = connstate_->state.load(std::memory_order_relaxed);
+  if (state != ConnectionState::TransportConnected &&
+      state != ConnectionState::BroadcastAccepted) {
+    return -1;
+  }
+  if (int error = waitForBudget(size)) {
+    return error;
+  }
+  auto* task = getWriteTask();
+  task->nodes.emplace_back(
+      Pool::Node::wrap(const_cast<uint8_t*>(data), size, release, opaque));
+  return queueMessage(task);
+}
+
+int RushClient::reserveFrame(size_t length) {
+  const auto state = connstate_->state.load(std::memory_order_relaxed);
+  if (state != ConnectionState::TransportConnected &&
+      state != ConnectionState::BroadcastAccepted) {
+    return -1;
+  }
+  return waitForBudget(length);
+}
+
+int RushClient::sendFrame(const Serializable& frame) {
+  auto* task = getWriteTask();
+  NodeSink sink(pool_, task->nodes, frame.length());
+  Cursor cursor(&sink);
+  cursor << frame;
+
+  // every node but the last one was filled
+  size_t remaining = cursor.position();
+  for (auto& node : task->nodes) {
+    node.length = std::min(node.getCapacity(), remaining);
+    remaining -= node.length;
+  }
+  return queueMessage(task);
+}
+
+// indexes a message by the header of the RUSH frame it starts with. Only a
+// message holding exactly one video or audio frame is flagged as media
+static void
+describeFrame(const Pool::Node& head, size_t length, FrameEntry& frame) {
+  frame = FrameEntry{};
+  try {
+    Cursor cursor(head.data, head.length);
+    uint64_t frameLength{0};
+    uint8_t type{0};
+    uint8_t codec{0};
+    uint64_t pts{0};
+    uint64_t dts{0};
+    cursor.readBE(frameLength);
+    cursor.readBE(frame.sequenceId);
+    cursor.read(type);
+    if (frameLength != length) {
+      return;
+    }
+
+    switch (static_cast<FrameTypes>(type)) {
+      case FrameTypes::VideoWithTrack: {
+        uint16_t requiredFrameOffset{0};
+        cursor.read(codec);
+        cursor.readBE(pts);
+        cursor.readBE(dts);
+        cursor.read(frame.trackId);
+        cursor.readBE(requiredFrameOffset);
+        frame.flags = kFrameVideo | (requiredFrameOffset ? 0 : kFrameKey);
+        break;
+      }
+      case FrameTypes::AudioWithTrack:
+      case FrameTypes::AudioWithHeader:
+        cursor.read(codec);
+        cursor.readBE(pts);
+        cursor.read(frame.trackId);
+        frame.flags = kFrameAudio;
+        break;
+      default:
+        break;
+    }
+  } catch (const std::out_of_range&) {
+    // shorter than a frame header
+  }
+}
+
+int RushClient::queueMessage(WriteTask* task) {
+  if (task->nodes.empty()) {
+    freeTasks_.push(task);
+  } else {
+    task->length = 0;
+    for (const auto& node : task->nodes) {
+      task->length += node.length;
+    }
+    describeFrame(task->nodes.front(), task->length, task->frame);
+    task->frame.enqueueTs = timestamp();
+    queuedBytes_.fetch_add(task->length, std::memory_order_relaxed);
+    loop_->post(task);
+  }
 
   // Assume the first frame is a connect frame and wait for connect-ack from
   // the broadcast server
@@ -270,7 +964,7 @@ int RushClient::sendMessage(const uint8_t* data, size_t size) {
                 << std::endl;
       loop_->enqueueAndWait([&]() { return conn_->disconnect(); });
       std::cerr << "Disconnected sent" << std::endl;
-      return -1;
+      return RUSH_ERR_CONNECT_FAILED;
     }
 
     // Received an Error frame. Connection is closed as part of the standard
@@ -278,7 +972,7 @@ int RushClient::sendMessage(const uint8_t* data, size_t size) {
     if (connstate_->state != ConnectionState::BroadcastAccepted) {
       std::cerr << "Error while waiting for connect acknowledgement"
                 << std::endl;
-      return -1;
+      return RUSH_ERR_CONNECT_FAILED;
     }
   }
   return 0;
@@ -292,7 +986,39 @@ void RushClient::changeState(ConnectionState state) {
   connstate_->stateCv.notify_all();
 }
 
+void RushClient::onConnectionClosed() {
+  // senders waiting for budget return -1 now, and a sender refused before
+  // learns through its retry that the connection is gone
+  {
+    std::lock_guard<std::mutex> guard(budgetMutex_);
+  }
+  budgetCv_.notify_all();
+  if (wouldBlock_.exchange(false) && writableCallback_) {
+    writableCallback_(writableOpaque_);
+  }
+  if (!runtime_) {
+    loop_->stop();
+  }
+}
+
 int RushClient::close() {
-  thread_.join();
+  if (!runtime_) {
+    thread_.join();
+  } else {
+    std::unique_lock<std::mutex> lock(connstate_->stateMutex);
+    connstate_->stateCv.wait(
+        lock, [&] { return connstate_->state == ConnectionState::Stopped; });
+  }
+  pool_.printStats();
+  if (config_.multiStream) {
+    std::cout << "uni streams opened: " << multiStreamStats_.opened
+              << " waits for stream credit: " << multiStreamStats_.creditWaits
+              << std::endl;
+  }
+  for (const auto& [trackId, stats] : dropStats_) {
+    std::cout << "track " << static_cast<uint16_t>(trackId)
+              << " dropped frames: " << stats.frames
+              << " bytes: " << stats.bytes << std::endl;
+  }
   return 0;
 }
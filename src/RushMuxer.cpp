@@ -9,7 +9,6 @@
 #include "RushMuxer.h"
 
 #include "CodecUtils.h"
-#include "Frames.h"
 
 #include <cstring>
 #include <iostream>
@@ -99,7 +98,7 @@ ssize_t RushMuxer::connectFrame(
   return writeCursor.position();
 }
 
-ssize_t RushMuxer::videoWithTrackFrame(
+VideoWithTrackFrame RushMuxer::makeVideoWithTrackFrame(
     VideoCodec codec,
     uint8_t index,
     bool isKeyFrame,
@@ -108,9 +107,7 @@ ssize_t RushMuxer::videoWithTrackFrame(
     uint64_t pts,
     uint64_t dts,
     uint8_t* extradata,
-    int extradataLength,
-    uint8_t* buffer,
-    int bufferLength) {
+    int extradataLength) {
   if (!videoCodecValid(codec)) {
     throw std::runtime_error("Invalid video codec");
   }
@@ -123,7 +120,7 @@ ssize_t RushMuxer::videoWithTrackFrame(
   const uint8_t trackId = indexToTrackId_[index];
   const uint16_t requiredFrameOffset =
       getRequiredFrameOffset(isKeyFrame, sequenceId, index);
-  VideoWithTrackFrame frame(
+  return VideoWithTrackFrame(
       sequenceId,
       codec,
       pts,
@@ -132,6 +129,30 @@ ssize_t RushMuxer::videoWithTrackFrame(
       requiredFrameOffset,
       sample,
       codecData);
+}
+
+ssize_t RushMuxer::videoWithTrackFrame(
+    VideoCodec codec,
+    uint8_t index,
+    bool isKeyFrame,
+    uint8_t* data,
+    int length,
+    uint64_t pts,
+    uint64_t dts,
+    uint8_t* extradata,
+    int extradataLength,
+    uint8_t* buffer,
+    int bufferLength) {
+  const auto frame = makeVideoWithTrackFrame(
+      codec,
+      index,
+      isKeyFrame,
+      data,
+      length,
+      pts,
+      dts,
+      extradata,
+      extradataLength);
 
   Cursor writeCursor(buffer, bufferLength);
   writeCursor << frame;
@@ -165,16 +186,14 @@ uint16_t RushMuxer::getRequiredFrameOffset(
   return offset;
 }
 
-ssize_t RushMuxer::audioWithTrackFrame(
+AudioWithTrackFrame RushMuxer::makeAudioWithTrackFrame(
     AudioCodec codec,
     uint8_t index,
     uint8_t* data,
     int length,
     uint64_t pts,
     uint8_t* extradata,
-    int extradataLength,
-    uint8_t* buffer,
-    int bufferLength) {
+    int extradataLength) {
   if (!audioCodecValid(codec)) {
     throw std::runtime_error("Invalid audio codec");
   }
@@ -184,7 +203,22 @@ ssize_t RushMuxer::audioWithTrackFrame(
   const auto sample = ByteStream(data, length);
   const auto codecData =
       addExtradata ? ByteStream(extradata, extradataLength) : ByteStream();
-  AudioWithTrackFrame frame(sequenceId, codec, pts, trackId, sample, codecData);
+  return AudioWithTrackFrame(
+      sequenceId, codec, pts, trackId, sample, codecData);
+}
+
+ssize_t RushMuxer::audioWithTrackFrame(
+    AudioCodec codec,
+    uint8_t index,
+    uint8_t* data,
+    int length,
+    uint64_t pts,
+    uint8_t* extradata,
+    int extradataLength,
+    uint8_t* buffer,
+    int bufferLength) {
+  const auto frame = makeAudioWithTrackFrame(
+      codec, index, data, length, pts, extradata, extradataLength);
 
   Cursor writeCursor(buffer, bufferLength);
   writeCursor << frame;
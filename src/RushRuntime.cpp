@@ -0,0 +1,53 @@
+// Copyright (c) Meta Platforms, Inc. and affiliates.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#include "RushRuntime.h"
+
+#include <algorithm>
+
+using namespace rush;
+
+RushRuntime::RushRuntime(size_t threads) {
+  if (!threads) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  loops_.reserve(threads);
+  threads_.reserve(threads);
+  clients_.resize(threads);
+  for (size_t i = 0; i < threads; ++i) {
+    auto loop = std::make_shared<EvLoop>();
+    // the loop's async watcher keeps it running while no client is bound
+    threads_.emplace_back([loop]() { loop->run(0); });
+    loops_.push_back(std::move(loop));
+  }
+}
+
+RushRuntime::~RushRuntime() {
+  for (auto& loop : loops_) {
+    loop->enqueue([loop = loop.get()]() { loop->stop(); });
+  }
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+std::shared_ptr<EvLoop> RushRuntime::acquireLoop() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  const auto index = static_cast<size_t>(std::distance(
+      clients_.begin(), std::min_element(clients_.begin(), clients_.end())));
+  ++clients_[index];
+  return loops_[index];
+}
+
+void RushRuntime::releaseLoop(const std::shared_ptr<EvLoop>& loop) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  const auto it = std::find(loops_.begin(), loops_.end(), loop);
+  if (it != loops_.end()) {
+    --clients_[static_cast<size_t>(std::distance(loops_.begin(), it))];
+  }
+}
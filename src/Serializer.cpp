@@ -8,6 +8,8 @@
 
 #include <Serializer.h>
 
+#include <algorithm>
+
 namespace rush {
 
 template <>
@@ -18,6 +20,8 @@ size_t lengthParams(ByteStream stream) {
 Cursor::Cursor(uint8_t* data, size_t length)
     : start_(data), end_(data + length), pos_{start_} {}
 
+Cursor::Cursor(CursorSink* sink) : sink_(sink) {}
+
 bool Cursor::canAdvance(size_t length) {
   return pos_ + length <= end_;
 }
@@ -27,7 +31,7 @@ void Cursor::advance(size_t length) {
 }
 
 size_t Cursor::position() const {
-  return pos_ - start_;
+  return base_ + static_cast<size_t>(pos_ - start_);
 }
 
 bool Cursor::available() const {
@@ -37,49 +41,59 @@ bool Cursor::available() const {
   return pos_ < end_;
 }
 
-template <>
-void Cursor::write<ByteStream>(ByteStream stream) {
-  if (!canAdvance(stream.length)) {
+void Cursor::writeBytes(const uint8_t* data, size_t length) {
+  if (!sink_ && !canAdvance(length)) {
     throw std::out_of_range("invalid range");
   }
-  std::memcpy(pos_, stream.data, stream.length);
-  advance(stream.length);
+  while (length) {
+    if (pos_ == end_) {
+      uint8_t* segment{nullptr};
+      size_t segmentLength{0};
+      if (!sink_ || !sink_->nextSegment(segment, segmentLength)) {
+        throw std::out_of_range("invalid range");
+      }
+      base_ = position();
+      start_ = pos_ = segment;
+      end_ = segment + segmentLength;
+    }
+    const size_t chunk = std::min(length, static_cast<size_t>(end_ - pos_));
+    std::memcpy(pos_, data, chunk);
+    advance(chunk);
+    data += chunk;
+    length -= chunk;
+  }
+}
+
+template <>
+void Cursor::write<ByteStream>(ByteStream stream) {
+  writeBytes(stream.data, stream.length);
 }
 
 template <>
 void Cursor::write<uint8_t>(uint8_t val) {
-  if (!canAdvance(sizeof(val))) {
-    throw std::out_of_range("invalid range");
-  }
-  pos_[0] = val;
-  advance(sizeof(val));
+  writeBytes(&val, sizeof(val));
 }
 
 template <>
 void Cursor::write<uint16_t>(uint16_t val) {
-  if (!canAdvance(sizeof(val))) {
-    throw std::out_of_range("invalid range");
-  }
-  pos_[0] = static_cast<uint8_t>(val);
-  pos_[1] = static_cast<uint8_t>(val >> 8);
-  advance(sizeof(val));
+  const uint8_t bytes[] = {
+      static_cast<uint8_t>(val), static_cast<uint8_t>(val >> 8)};
+  writeBytes(bytes, sizeof(bytes));
 }
 
 template <>
 void Cursor::write<uint32_t>(uint32_t val) {
-  if (!canAdvance(sizeof(val))) {
-    throw std::out_of_range("invalid range");
-  }
-  pos_[0] = static_cast<uint8_t>(val);
-  pos_[1] = static_cast<uint8_t>(val >> 8);
-  pos_[2] = static_cast<uint8_t>(val >> 16);
-  pos_[3] = static_cast<uint8_t>(val >> 24);
-  advance(sizeof(val));
+  const uint8_t bytes[] = {
+      static_cast<uint8_t>(val),
+      static_cast<uint8_t>(val >> 8),
+      static_cast<uint8_t>(val >> 16),
+      static_cast<uint8_t>(val >> 24)};
+  writeBytes(bytes, sizeof(bytes));
 }
 
 template <>
 void Cursor::write<uint64_t>(uint64_t val) {
-  if (!canAdvance(sizeof(val))) {
+  if (!sink_ && !canAdvance(sizeof(val))) {
     throw std::out_of_range("invalid range");
   }
   write<uint32_t>(static_cast<uint32_t>(val & 0xFFFFFFFF));
@@ -93,47 +107,34 @@ void Cursor::write<uint64_t>(uint64_t val) {
 
 template <>
 void Cursor::writeBE<ByteStream>(ByteStream stream) {
-  if (!canAdvance(stream.length)) {
-    throw std::out_of_range("invalid range");
-  }
-  std::memcpy(pos_, stream.data, stream.length);
-  advance(stream.length);
+  writeBytes(stream.data, stream.length);
 }
 
 template <>
 void Cursor::writeBE<uint8_t>(uint8_t val) {
-  if (!canAdvance(sizeof(val))) {
-    throw std::out_of_range("invalid range");
-  }
-  pos_[0] = val;
-  advance(sizeof(val));
+  writeBytes(&val, sizeof(val));
 }
 
 template <>
 void Cursor::writeBE<uint16_t>(uint16_t val) {
-  if (!canAdvance(sizeof(val))) {
-    throw std::out_of_range("invalid range");
-  }
-  pos_[0] = static_cast<uint8_t>(val >> 8);
-  pos_[1] = static_cast<uint8_t>(val);
-  advance(sizeof(val));
+  const uint8_t bytes[] = {
+      static_cast<uint8_t>(val >> 8), static_cast<uint8_t>(val)};
+  writeBytes(bytes, sizeof(bytes));
 }
 
 template <>
 void Cursor::writeBE<uint32_t>(uint32_t val) {
-  if (!canAdvance(sizeof(val))) {
-    throw std::out_of_range("invalid range");
-  }
-  pos_[0] = static_cast<uint8_t>(val >> 24);
-  pos_[1] = static_cast<uint8_t>(val >> 16);
-  pos_[2] = static_cast<uint8_t>(val >> 8);
-  pos_[3] = static_cast<uint8_t>(val);
-  advance(sizeof(val));
+  const uint8_t bytes[] = {
+      static_cast<uint8_t>(val >> 24),
+      static_cast<uint8_t>(val >> 16),
+      static_cast<uint8_t>(val >> 8),
+      static_cast<uint8_t>(val)};
+  writeBytes(bytes, sizeof(bytes));
 }
 
 template <>
 void Cursor::writeBE<uint64_t>(uint64_t val) {
-  if (!canAdvance(sizeof(val))) {
+  if (!sink_ && !canAdvance(sizeof(val))) {
     throw std::out_of_range("invalid range");
   }
   writeBE<uint32_t>(static_cast<uint32_t>(val >> 32));
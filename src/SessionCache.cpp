@@ -0,0 +1,132 @@
+// Copyright (c) Meta Platforms, Inc. and affiliates.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#include "SessionCache.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// The file holds one entry per line:
+// <key> <hex session> <remembered transport parameters...>
+static void writeParams(std::ostream& out, const ngtcp2_transport_params& p) {
+  out << p.initial_max_streams_bidi << " " << p.initial_max_streams_uni << " "
+      << p.initial_max_stream_data_bidi_local << " "
+      << p.initial_max_stream_data_bidi_remote << " "
+      << p.initial_max_stream_data_uni << " " << p.initial_max_data << " "
+      << p.active_connection_id_limit << " " << p.max_datagram_frame_size;
+}
+
+static bool readParams(std::istream& in, ngtcp2_transport_params& p) {
+  ngtcp2_transport_params_default(&p);
+  in >> p.initial_max_streams_bidi >> p.initial_max_streams_uni >>
+      p.initial_max_stream_data_bidi_local >>
+      p.initial_max_stream_data_bidi_remote >> p.initial_max_stream_data_uni >>
+      p.initial_max_data >> p.active_connection_id_limit >>
+      p.max_datagram_frame_size;
+  return !in.fail();
+}
+
+static std::string toHex(const std::vector<uint8_t>& data) {
+  std::ostringstream out;
+  out << std::hex << std::setfill('0');
+  for (const auto byte : data) {
+    out << std::setw(2) << static_cast<uint16_t>(byte);
+  }
+  return out.str();
+}
+
+static bool fromHex(const std::string& hex, std::vector<uint8_t>& data) {
+  if (hex.size() % 2) {
+    return false;
+  }
+  data.clear();
+  data.reserve(hex.size() / 2);
+  for (size_t i = 0; i < hex.size(); i += 2) {
+    try {
+      data.push_back(
+          static_cast<uint8_t>(std::stoul(hex.substr(i, 2), nullptr, 16)));
+    } catch (const std::exception&) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+namespace rush {
+
+SessionCache& SessionCache::getInstance() {
+  static SessionCache cache;
+  return cache;
+}
+
+void SessionCache::setFile(const std::string& path) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (path == path_) {
+    return;
+  }
+  path_ = path;
+  load();
+}
+
+std::optional<SessionCacheEntry> SessionCache::find(const std::string& key) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  const auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+void SessionCache::store(const std::string& key, SessionCacheEntry&& entry) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  entries_[key] = std::move(entry);
+  save();
+}
+
+void SessionCache::load() {
+  std::ifstream file(path_);
+  if (!file) {
+    return;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream in(line);
+    std::string key, hex;
+    SessionCacheEntry entry;
+    if (!(in >> key >> hex) || !fromHex(hex, entry.session) ||
+        !readParams(in, entry.params)) {
+      std::cerr << "Ignoring malformed session cache entry" << std::endl;
+      continue;
+    }
+    entries_[key] = std::move(entry);
+  }
+}
+
+void SessionCache::save() {
+  if (path_.empty()) {
+    return;
+  }
+  std::ofstream file(path_, std::ios::trunc);
+  if (!file) {
+    std::cerr << "Could not write session cache " << path_ << std::endl;
+    return;
+  }
+  for (const auto& [key, entry] : entries_) {
+    file << key << " " << toHex(entry.session) << " ";
+    writeParams(file, entry.params);
+    file << "\n";
+  }
+}
+
+} // namespace rush
@@ -18,9 +18,11 @@ namespace rush {
 
 std::unique_ptr<TLSClientContext> createTLSContext() {
 #ifdef TLS_USE_GNUTLS
-  return std::make_unique<GNUTLSClientContext>();
+  return std::make_unique<GNUTLSClientContext>(
+      GNUTLSClientContext::getSharedCredentials());
 #else
-  return std::make_unique<OpensslClientContext>();
+  return std::make_unique<OpensslClientContext>(
+      OpensslClientContext::getSharedContext());
 #endif
 }
 
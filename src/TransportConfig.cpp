@@ -0,0 +1,139 @@
+// Copyright (c) Meta Platforms, Inc. and affiliates.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#include "TransportConfig.h"
+
+#include <iostream>
+
+// largest UDP payload of an IPv4 datagram
+static constexpr uint32_t kMaxUdpPayloadSize = 65507;
+// RFC 9000 section 18.2
+static constexpr uint8_t kMaxAckDelayExponent = 20;
+
+static constexpr uint64_t kDefaultWindow = 1024 * 1024;
+static constexpr uint64_t kDefaultMaxWindow = 16 * 1024 * 1024;
+static constexpr uint32_t kDefaultUdpPayloadSize = 1452;
+static constexpr uint32_t kDefaultInitialRttMs = 333;
+static constexpr uint32_t kDefaultIdleTimeoutMs = 300 * 1000;
+static constexpr uint32_t kDefaultMaxBurstPackets = 10;
+
+namespace rush {
+
+RushTransportConfig getDefaultTransportConfig() {
+  RushTransportConfig config{};
+  config.congestionControl = RUSH_CC_BBR;
+  config.initialMaxData = kDefaultWindow;
+  config.initialMaxStreamData = kDefaultWindow;
+  config.maxWindow = kDefaultMaxWindow;
+  config.maxUdpPayloadSize = kDefaultUdpPayloadSize;
+  config.ackDelayExponent = NGTCP2_DEFAULT_ACK_DELAY_EXPONENT;
+  config.initialRttMs = kDefaultInitialRttMs;
+  config.idleTimeoutMs = kDefaultIdleTimeoutMs;
+  config.maxBurstPackets = kDefaultMaxBurstPackets;
+  config.pacingOffload = 0;
+  config.earlyData = 1;
+  config.sessionCacheFile = nullptr;
+  config.hugePages = 0;
+  config.maxQueuedBytes = 0;
+  config.maxQueuedMs = 0;
+  config.sendTimeoutMs = 0;
+  config.maxQueueDelayMs = 0;
+  config.multiStream = 0;
+  config.maxStreamsUni = 3;
+  return config;
+}
+
+int validateTransportConfig(const RushTransportConfig& config) {
+  switch (config.congestionControl) {
+    case RUSH_CC_RENO:
+    case RUSH_CC_CUBIC:
+    case RUSH_CC_BBR:
+    case RUSH_CC_BBR2:
+      break;
+    default:
+      std::cerr << "Invalid congestion control algorithm "
+                << config.congestionControl << std::endl;
+      return -1;
+  }
+
+  if (!config.initialMaxData || config.initialMaxData > NGTCP2_MAX_VARINT) {
+    std::cerr << "initialMaxData must be in [1, 2^62)" << std::endl;
+    return -1;
+  }
+
+  if (!config.initialMaxStreamData ||
+      config.initialMaxStreamData > NGTCP2_MAX_VARINT) {
+    std::cerr << "initialMaxStreamData must be in [1, 2^62)" << std::endl;
+    return -1;
+  }
+
+  if (config.maxWindow &&
+      (config.maxWindow < config.initialMaxData ||
+       config.maxWindow < config.initialMaxStreamData ||
+       config.maxWindow > NGTCP2_MAX_VARINT)) {
+    std::cerr << "maxWindow must be 0 or between the initial windows and 2^62"
+              << std::endl;
+    return -1;
+  }
+
+  if (config.maxUdpPayloadSize < kMinUdpPayloadSize ||
+      config.maxUdpPayloadSize > kMaxUdpPayloadSize) {
+    std::cerr << "maxUdpPayloadSize must be in [" << kMinUdpPayloadSize
+              << ", " << kMaxUdpPayloadSize << "]" << std::endl;
+    return -1;
+  }
+
+  if (config.ackDelayExponent > kMaxAckDelayExponent) {
+    std::cerr << "ackDelayExponent must not exceed "
+              << static_cast<uint16_t>(kMaxAckDelayExponent) << std::endl;
+    return -1;
+  }
+
+  if (!config.initialRttMs) {
+    std::cerr << "initialRttMs must not be 0" << std::endl;
+    return -1;
+  }
+
+  if (!config.maxBurstPackets || config.maxBurstPackets > kMaxBurstPackets) {
+    std::cerr << "maxBurstPackets must be in [1, " << kMaxBurstPackets << "]"
+              << std::endl;
+    return -1;
+  }
+
+  if (config.multiStream != 0 &&
+      config.multiStream != RUSH_MULTI_STREAM_FRAME &&
+      config.multiStream != RUSH_MULTI_STREAM_TRACK) {
+    std::cerr << "Invalid multiStream mode " << config.multiStream
+              << std::endl;
+    return -1;
+  }
+
+  if (static_cast<uint64_t>(config.maxStreamsUni) > NGTCP2_MAX_STREAMS) {
+    std::cerr << "maxStreamsUni must not exceed " << NGTCP2_MAX_STREAMS
+              << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
+
+ngtcp2_cc_algo getCongestionControlAlgorithm(RushCongestionControl cc) {
+  switch (cc) {
+    case RUSH_CC_RENO:
+      return NGTCP2_CC_ALGO_RENO;
+    case RUSH_CC_CUBIC:
+      return NGTCP2_CC_ALGO_CUBIC;
+    case RUSH_CC_BBR2:
+      return NGTCP2_CC_ALGO_BBR2;
+    case RUSH_CC_BBR:
+    default:
+      return NGTCP2_CC_ALGO_BBR;
+  }
+}
+
+} // namespace rush
@@ -8,6 +8,8 @@
 
 #include "Utils.h"
 
+#include <linux/net_tstamp.h>
+#include <netinet/udp.h>
 #include <cassert>
 #include <ctime>
 #include <iomanip>
@@ -30,9 +32,79 @@ int createUdpSocket(int family) {
   if (fd == -1) {
     return -1;
   }
+
+  // report the TOS / traffic class byte of received datagrams so that ECN
+  // codepoints can be handed to ngtcp2
+  int enable{1};
+  const int error = family == AF_INET6
+      ? setsockopt(
+            fd, IPPROTO_IPV6, IPV6_RECVTCLASS, &enable, sizeof(enable))
+      : setsockopt(fd, IPPROTO_IP, IP_RECVTOS, &enable, sizeof(enable));
+  if (error) {
+    std::cerr << "Could not enable ECN reporting [" << strerror(errno) << "]"
+              << std::endl;
+  }
+
+  // set DF and ignore the kernel's path MTU cache, datagram sizes are
+  // discovered by probing (DPLPMTUD) instead of relying on ICMP
+  int pmtuError{0};
+  if (family == AF_INET6) {
+    int probe = IPV6_PMTUDISC_PROBE;
+    pmtuError =
+        setsockopt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &probe, sizeof(probe));
+  } else {
+    int probe = IP_PMTUDISC_PROBE;
+    pmtuError =
+        setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &probe, sizeof(probe));
+  }
+  if (pmtuError) {
+    std::cerr << "Could not enable path MTU probing [" << strerror(errno)
+              << "]" << std::endl;
+  }
   return fd;
 }
 
+bool isGsoSupported(int fd) {
+#ifdef UDP_SEGMENT
+  int segmentSize{0};
+  socklen_t len = sizeof(segmentSize);
+  return getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segmentSize, &len) == 0;
+#else
+  return false;
+#endif
+}
+
+bool enableGro(int fd) {
+#ifdef UDP_GRO
+  int enable{1};
+  return setsockopt(fd, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) == 0;
+#else
+  return false;
+#endif
+}
+
+bool enableTxTime(int fd) {
+#ifdef SO_TXTIME
+  sock_txtime config{};
+  config.clockid = CLOCK_MONOTONIC;
+  return setsockopt(fd, SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) == 0;
+#else
+  return false;
+#endif
+}
+
+size_t getPathMtu(int fd, int family) {
+  int mtu{0};
+  socklen_t len = sizeof(mtu);
+  const int error = family == AF_INET6
+      ? getsockopt(fd, IPPROTO_IPV6, IPV6_MTU, &mtu, &len)
+      : getsockopt(fd, IPPROTO_IP, IP_MTU, &mtu, &len);
+  if (error || mtu <= 0) {
+    return 0;
+  }
+  return static_cast<size_t>(mtu);
+}
+
 int createSocket(
     const char* remoteHost,
     const char* remotePort,
@@ -123,4 +195,11 @@ std::string getIPAddress(const Address& address) {
   }
 }
 
+uint16_t getPort(const Address& address) {
+  if (address.su.storage.ss_family == AF_INET6) {
+    return ntohs(address.su.in6.sin6_port);
+  }
+  return ntohs(address.su.in.sin_port);
+}
+
 } // namespace rush
@@ -0,0 +1,257 @@
+// Copyright (c) Meta Platforms, Inc. and affiliates.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Buffer.h"
+
+using namespace rush;
+
+namespace {
+
+// one node per string, enqueued at time 'sequenceId'
+void insert(
+    Buffer& buffer,
+    Pool& pool,
+    const std::vector<std::string>& nodes,
+    uint64_t sequenceId) {
+  std::vector<Pool::Node> message;
+  for (const auto& data : nodes) {
+    auto node = pool.get(data.size());
+    std::copy(data.begin(), data.end(), node.data);
+    node.length = data.size();
+    message.emplace_back(std::move(node));
+  }
+  FrameEntry frame;
+  frame.sequenceId = sequenceId;
+  frame.enqueueTs = sequenceId;
+  buffer.insert(message, frame);
+}
+
+// concatenates what getData() offers without moving the cursor
+std::string peek(Buffer& buffer, size_t vecCount = 256) {
+  std::vector<ngtcp2_vec> vec(vecCount);
+  const size_t count = buffer.getData(vec.data(), vec.size());
+  std::string data;
+  for (size_t i = 0; i < count; ++i) {
+    data.append(reinterpret_cast<const char*>(vec[i].base), vec[i].len);
+  }
+  return data;
+}
+
+std::vector<uint64_t> popDelivered(Buffer& buffer) {
+  std::vector<uint64_t> delivered;
+  FrameEntry frame;
+  while (buffer.popDelivered(frame)) {
+    delivered.push_back(frame.sequenceId);
+  }
+  return delivered;
+}
+
+struct DropContext {
+  std::vector<uint64_t> drop;
+  std::vector<std::pair<uint64_t, uint64_t>> dropped;
+};
+
+bool dropListed(const FrameEntry& frame, size_t, void* context) {
+  const auto& drop = static_cast<DropContext*>(context)->drop;
+  return std::find(drop.begin(), drop.end(), frame.sequenceId) != drop.end();
+}
+
+void recordDropped(const FrameEntry& frame, uint64_t length, void* context) {
+  static_cast<DropContext*>(context)->dropped.emplace_back(
+      frame.sequenceId, length);
+}
+
+} // namespace
+
+TEST(BufferTest, InsertIndexesMessages) {
+  Pool pool;
+  Buffer buffer;
+  EXPECT_FALSE(buffer.available());
+  EXPECT_EQ(peek(buffer), "");
+
+  insert(buffer, pool, {"aaaa", "aa"}, 1);
+  insert(buffer, pool, {"bbb"}, 2);
+
+  EXPECT_TRUE(buffer.available());
+  EXPECT_EQ(buffer.queuedBytes(), 9u);
+  EXPECT_EQ(buffer.unsentBytes(), 9u);
+  ASSERT_EQ(buffer.queuedFrames(), 2u);
+  EXPECT_EQ(buffer.frames()[0].end, 6u);
+  EXPECT_EQ(buffer.frames()[0].nodes, 2u);
+  EXPECT_EQ(buffer.frames()[1].end, 9u);
+  EXPECT_EQ(buffer.frames()[1].nodes, 1u);
+  EXPECT_EQ(peek(buffer), "aaaaaabbb");
+  EXPECT_EQ(peek(buffer, 2), "aaaaaa");
+  buffer.reset(pool);
+}
+
+TEST(BufferTest, PartialMoveCursor) {
+  Pool pool;
+  Buffer buffer;
+  insert(buffer, pool, {"aaaa"}, 1);
+  insert(buffer, pool, {"bbbb"}, 2);
+
+  buffer.moveCursor(3);
+  EXPECT_EQ(peek(buffer), "abbbb");
+  EXPECT_EQ(buffer.unsentBytes(), 5u);
+  EXPECT_EQ(buffer.unstarted(), 1u);
+
+  // crosses the node boundary and stops inside the second node
+  buffer.moveCursor(2);
+  EXPECT_EQ(peek(buffer), "bbb");
+  EXPECT_EQ(buffer.unstarted(), 2u);
+
+  buffer.moveCursor(3);
+  EXPECT_FALSE(buffer.available());
+  EXPECT_EQ(buffer.unsentBytes(), 0u);
+  EXPECT_EQ(buffer.queuedBytes(), 8u);
+  buffer.reset(pool);
+}
+
+TEST(BufferTest, PartialPurge) {
+  Pool pool;
+  Buffer buffer;
+  insert(buffer, pool, {"aaaa", "aa"}, 1);
+  insert(buffer, pool, {"bbb"}, 2);
+  buffer.moveCursor(9);
+
+  buffer.purge(5, pool);
+  EXPECT_EQ(buffer.queuedBytes(), 4u);
+  EXPECT_TRUE(popDelivered(buffer).empty());
+
+  buffer.purge(1, pool);
+  EXPECT_EQ(popDelivered(buffer), std::vector<uint64_t>{1});
+
+  buffer.purge(2, pool);
+  EXPECT_TRUE(popDelivered(buffer).empty());
+  buffer.purge(1, pool);
+  EXPECT_EQ(popDelivered(buffer), std::vector<uint64_t>{2});
+  EXPECT_EQ(buffer.queuedBytes(), 0u);
+  EXPECT_EQ(buffer.queuedFrames(), 0u);
+}
+
+TEST(BufferTest, GrowKeepsWrappedOrder) {
+  Pool pool;
+  Buffer buffer;
+  std::string expected;
+  uint64_t sequenceId = 0;
+
+  // moves the ring's head away from index 0 so the nodes wrap around the
+  // end of the ring when it doubles
+  for (; sequenceId < 40; ++sequenceId) {
+    insert(buffer, pool, {"x"}, sequenceId);
+  }
+  buffer.moveCursor(40);
+  buffer.purge(40, pool);
+  EXPECT_EQ(popDelivered(buffer).size(), 40u);
+
+  for (; sequenceId < 240; ++sequenceId) {
+    const std::string data(1, static_cast<char>('0' + sequenceId % 64));
+    insert(buffer, pool, {data}, sequenceId);
+    expected += data;
+  }
+  EXPECT_EQ(buffer.queuedFrames(), 200u);
+  EXPECT_EQ(peek(buffer), expected);
+
+  buffer.moveCursor(100);
+  buffer.purge(100, pool);
+  EXPECT_EQ(popDelivered(buffer).size(), 100u);
+  EXPECT_EQ(peek(buffer), expected.substr(100));
+  buffer.reset(pool);
+}
+
+TEST(BufferTest, RewindToFirstUnackedByte) {
+  Pool pool;
+  Buffer buffer;
+  insert(buffer, pool, {"aaaa"}, 1);
+  insert(buffer, pool, {"bbbb"}, 2);
+  insert(buffer, pool, {"cccc"}, 3);
+  buffer.moveCursor(10);
+  buffer.purge(2, pool);
+
+  buffer.rewind();
+  EXPECT_EQ(peek(buffer), "aabbbbcccc");
+  EXPECT_EQ(buffer.unsentBytes(), 10u);
+  EXPECT_EQ(buffer.unstarted(), 1u);
+  EXPECT_EQ(buffer.oldestQueued(), 1u);
+  EXPECT_EQ(buffer.oldestUnsent(), 1u);
+
+  buffer.moveCursor(6);
+  EXPECT_EQ(peek(buffer), "cccc");
+  buffer.reset(pool);
+}
+
+TEST(BufferTest, DropUnstartedKeepsStartedMessage) {
+  Pool pool;
+  Buffer buffer;
+  insert(buffer, pool, {"aaaa"}, 1);
+  insert(buffer, pool, {"bb", "bb"}, 2);
+  insert(buffer, pool, {"ccc"}, 3);
+  insert(buffer, pool, {"dd", "d"}, 4);
+  insert(buffer, pool, {"eeee"}, 5);
+
+  // message 2 is partly written and is not offered for dropping
+  buffer.moveCursor(5);
+  ASSERT_EQ(buffer.unstarted(), 2u);
+
+  DropContext context;
+  context.drop = {1, 2, 3, 5};
+  buffer.dropUnstarted(pool, dropListed, recordDropped, &context);
+
+  const std::vector<std::pair<uint64_t, uint64_t>> dropped = {{3, 3}, {5, 4}};
+  EXPECT_EQ(context.dropped, dropped);
+  ASSERT_EQ(buffer.queuedFrames(), 3u);
+  EXPECT_EQ(buffer.frames()[0].sequenceId, 1u);
+  EXPECT_EQ(buffer.frames()[1].sequenceId, 2u);
+  EXPECT_EQ(buffer.frames()[2].sequenceId, 4u);
+  EXPECT_EQ(buffer.frames()[2].end, 11u);
+  EXPECT_EQ(buffer.queuedBytes(), 11u);
+  EXPECT_EQ(peek(buffer), "bbbddd");
+
+  buffer.moveCursor(6);
+  buffer.purge(11, pool);
+  EXPECT_EQ(popDelivered(buffer), (std::vector<uint64_t>{1, 2, 4}));
+  EXPECT_EQ(buffer.queuedBytes(), 0u);
+}
+
+TEST(BufferTest, DropUnstartedOnMessageBoundary) {
+  Pool pool;
+  Buffer buffer;
+  insert(buffer, pool, {"aaaa"}, 1);
+  insert(buffer, pool, {"bbbb"}, 2);
+  insert(buffer, pool, {"cccc"}, 3);
+
+  // message 1 is written completely, the cursor sits on a message boundary
+  buffer.moveCursor(4);
+  ASSERT_EQ(buffer.unstarted(), 1u);
+
+  DropContext context;
+  context.drop = {2};
+  buffer.dropUnstarted(pool, dropListed, recordDropped, &context);
+  EXPECT_EQ(context.dropped.size(), 1u);
+  EXPECT_EQ(peek(buffer), "cccc");
+
+  // dropping everything that is left empties the unsent part
+  context.drop = {3};
+  buffer.dropUnstarted(pool, dropListed, recordDropped, &context);
+  EXPECT_FALSE(buffer.available());
+  EXPECT_EQ(buffer.unsentBytes(), 0u);
+  EXPECT_EQ(buffer.oldestUnsent(), 0u);
+
+  insert(buffer, pool, {"dd"}, 4);
+  EXPECT_EQ(peek(buffer), "dd");
+  buffer.moveCursor(2);
+  buffer.purge(6, pool);
+  EXPECT_EQ(popDelivered(buffer), (std::vector<uint64_t>{1, 4}));
+}